@@ -0,0 +1,18 @@
+#include <stdint.h>
+#include "hal.h"
+#include "bench.h"
+
+#ifdef BENCH
+HAL_NEAR S_BENCH Bench[BENCH_PROBE_COUNT];
+
+void BenchEnd(uint8_t probe)
+{
+    S_BENCH* b = &Bench[probe];
+    HAL_CYCLES_T cycles = (HAL_CYCLES_T)(HalCycles() - b->start);
+
+    if (b->count == 0xFFFF) return;
+    b->count++;
+    b->total += cycles;
+    if (cycles > b->max) b->max = cycles;
+}
+#endif
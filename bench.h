@@ -0,0 +1,51 @@
+#pragma once
+#include <stdint.h>
+#include "hal.h"
+
+// Cycle probes around the tasks, ISRs and frame handlers. Only built in with
+// BENCH defined: otherwise every macro below is a no-op and the image is
+// unchanged. The count comes from HalCycles(), CPU cycles on the STM8 (TIM1
+// free-running at fMASTER) and nanoseconds on the host. host/bench.c drives a
+// scripted load and prints the table; on the board, read Bench[] from the
+// debugger. Costs 10 bytes of RAM per probe, 200 in all: more than the STM8's
+// .data segment has spare (firmware.stp), so a board build with BENCH needs
+// the segment widened into the stack's room. Not for the field.
+//
+// Probes don't nest with themselves, and an ISR landing inside a task probe
+// is counted in both.
+typedef enum
+{
+    BENCH_LOOP,          // One pass of the main loop, sleep excluded
+    BENCH_RX_TASK,
+    BENCH_DISPATCH,      // One event through the state machine
+    BENCH_UPDATE_LEDS,
+    BENCH_ISR_TICK,      // ISR_TIM4_UPDATE()
+    BENCH_LED_TICK,      // LedTick(), from the same vector
+    BENCH_ISR_UART_RX,
+    BENCH_ISR_UART_TX,
+    BENCH_ISR_SENSOR,
+    BENCH_ISR_BUTTON,
+    BENCH_FRAME,         // Process() by opcode, 0x00..0x08
+    BENCH_FRAME_OTHER = BENCH_FRAME + 9,
+    BENCH_PROBE_COUNT
+} E_BENCH_PROBE;
+
+typedef struct
+{
+    HAL_CYCLES_T start;
+    HAL_CYCLES_T max;
+    uint16_t count;      // Stops at 0xFFFF, and the others with it
+    uint32_t total;
+} S_BENCH;
+
+#ifdef BENCH
+#define BENCH_BEGIN(p)   (Bench[p].start = HalCycles())
+#define BENCH_END(p)     BenchEnd(p)
+
+void BenchEnd(uint8_t probe);
+
+extern HAL_NEAR S_BENCH Bench[BENCH_PROBE_COUNT];
+#else
+#define BENCH_BEGIN(p)   ((void)0)
+#define BENCH_END(p)     ((void)0)
+#endif
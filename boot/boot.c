@@ -0,0 +1,328 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include "hal.h"
+#include "ota.h"
+
+// Resident bootloader, OTA_BOOT_BASE up to OTA_APP_BASE (see ota.h).
+//
+// Out of reset it starts the application, unless the OTA record says an
+// upgrade is under way. Then it speaks just enough of the Tuya protocol to
+// keep the module talking and take the image: heartbeats, the handshake
+// queries, and the upgrade start (0x0A) and packages (0x0B). Everything is
+// polled with interrupts masked. Packages are programmed a block at a time
+// as they stream in, so no more than one block is ever held in RAM.
+
+enum
+{
+    HEADER_1 = 0x55,
+    HEADER_2 = 0xAA,
+    TX_VERSION = 0x03,
+    RX_VERSION = 0x00
+};
+
+enum
+{
+    OPCODE_HEARTBEAT = 0x00,
+    OPCODE_QUERY_PRODUCT_INFO = 0x01,
+    OPCODE_QUERY_MCU = 0x02,
+    OPCODE_REPORT_NETWORK_STATUS = 0x03,
+    OPCODE_UPGRADE_START = 0x0A,
+    OPCODE_UPGRADE_PACKAGE = 0x0B
+};
+
+// Receive state: where in a frame the next byte goes.
+typedef enum
+{
+    RX_HEADER_1,
+    RX_HEADER_2,
+    RX_VERSION_BYTE,
+    RX_OPCODE,
+    RX_LEN_H,
+    RX_LEN_L,
+    RX_PAYLOAD,
+    RX_CHECKSUM
+} E_RX;
+
+#define RX_LEN_MAX (0x400 + 4) // The biggest package a module sends, as in tuya.c
+#define RX_KEEP 4              // Leading payload bytes kept: the size or the offset
+#define SPILL_SIZE 16          /* must be a power of 2 */
+#define SPILL_MASK (SPILL_SIZE - 1)
+
+#define PRODUCT_KEY_MAX 16
+#define PRODUCT_INFO_HEAD "{\"p\":\""
+#define PRODUCT_INFO_TAIL "\",\"v\":\"0.0.0\",\"m\":0}" // Anything is newer
+
+static E_RX Rx = RX_HEADER_1;
+static uint8_t RxOpcode;
+static uint16_t RxLen;
+static uint16_t RxAt; // Payload bytes so far
+static uint8_t RxSum;
+static uint8_t RxKeep[RX_KEEP];
+
+static uint16_t ImageSize;
+static uint16_t Expected;  // Image offset of the next package
+static bool PackageTaken;  // The package coming in is Expected, and is being programmed
+static uint8_t Block[HAL_FLASH_BLOCK];
+static uint8_t BlockFill;
+static uint16_t BlockAt;   // Image offset of Block[0]
+
+// Bytes polled in while a block was being written, parsed before any new
+// ones. Only a few arrive per block, and a block takes 64 to fill.
+static uint8_t Spill[SPILL_SIZE];
+static uint8_t SpillHead = 0;
+static uint8_t SpillTail = 0;
+
+static uint8_t TxSum;
+
+static void TxBegin(uint8_t opcode, uint8_t len);
+static void Tx(uint8_t b);
+static void TxEnd(void);
+static void ProgramBlock(void);
+static void PackageByte(uint8_t b);
+static void PackageEnd(void);
+static void Process(void);
+static void RxByte(uint8_t b);
+
+void TxBegin(uint8_t opcode, uint8_t len)
+{
+    TxSum = 0;
+    Tx(HEADER_1);
+    Tx(HEADER_2);
+    Tx(TX_VERSION);
+    Tx(opcode);
+    Tx(0);
+    Tx(len);
+}
+
+void Tx(uint8_t b)
+{
+    TxSum += b;
+    HalUartPut(b);
+}
+
+void TxEnd(void)
+{
+    HalUartPut(TxSum);
+}
+
+void ProgramBlock(void)
+{
+    uint8_t rx[SPILL_SIZE / 2];
+    uint8_t got;
+    uint8_t i;
+
+    got = HalFlashProgramBlock(OTA_APP_BASE + BlockAt, Block, rx, sizeof(rx));
+    for (i = 0; i < got; i++)
+    {
+        Spill[SpillHead] = rx[i];
+        SpillHead = (SpillHead + 1) & SPILL_MASK;
+    }
+    BlockAt += HAL_FLASH_BLOCK;
+    BlockFill = 0;
+}
+
+void PackageByte(uint8_t b)
+{
+    if (RxAt == RX_KEEP)
+    {
+        // The offset is in: a package is taken only in order, block aligned,
+        // and within the image.
+        uint16_t offset = ((uint16_t)RxKeep[2] << 8) | RxKeep[3];
+        PackageTaken = !RxKeep[0] && !RxKeep[1] && offset == Expected &&
+                       !(offset % HAL_FLASH_BLOCK) &&
+                       RxLen - RX_KEEP <= ImageSize - offset;
+        BlockAt = offset;
+        BlockFill = 0;
+    }
+    if (!PackageTaken) return;
+
+    Block[BlockFill++] = b;
+    if (BlockFill == HAL_FLASH_BLOCK)
+    {
+        // Before the checksum is known: a bad package goes unacknowledged,
+        // and its retry writes the same blocks again.
+        ProgramBlock();
+    }
+}
+
+void PackageEnd(void)
+{
+    uint16_t offset = ((uint16_t)RxKeep[2] << 8) | RxKeep[3];
+    uint16_t crc = 0xFFFF;
+    uint16_t i;
+    const uint8_t* image = HAL_FLASH(OTA_APP_BASE);
+
+    if (RxLen > RX_KEEP)
+    {
+        if (!PackageTaken) return;
+        if (BlockFill)
+        {
+            while (BlockFill < HAL_FLASH_BLOCK) Block[BlockFill++] = 0; // As erased
+            ProgramBlock();
+        }
+        Expected += RxLen - RX_KEEP;
+        TxBegin(OPCODE_UPGRADE_PACKAGE, 0);
+        TxEnd();
+        return;
+    }
+
+    // An empty package ends the transfer. Check what actually went into
+    // flash, not what was received.
+    if (RxKeep[0] || RxKeep[1] || offset != Expected || Expected != ImageSize) return;
+    for (i = 0; i < ImageSize - 2; i++)
+    {
+        crc = OtaCrc16(crc, image[i]);
+    }
+    if (crc != (((uint16_t)image[ImageSize - 2] << 8) | image[ImageSize - 1]))
+    {
+        // Unacknowledged, so the module reports a failure. Until another
+        // transfer goes through, this is where the unit stays.
+        return;
+    }
+
+    TxBegin(OPCODE_UPGRADE_PACKAGE, 0);
+    TxEnd();
+    OtaRecordStore(OTA_IDLE, ImageSize); // Long enough for the last byte to go out
+    HalJumpToApp();
+}
+
+void Process(void)
+{
+    const char* key = HAL_PRODUCT_KEY;
+    uint32_t size;
+    uint8_t len;
+    uint8_t i;
+
+    switch (RxOpcode)
+    {
+        case OPCODE_HEARTBEAT:
+            TxBegin(OPCODE_HEARTBEAT, 1);
+            Tx(1);
+            TxEnd();
+            break;
+
+        case OPCODE_QUERY_PRODUCT_INFO:
+            for (len = 0; key[len] && len < PRODUCT_KEY_MAX; len++);
+            TxBegin(OPCODE_QUERY_PRODUCT_INFO,
+                    (sizeof(PRODUCT_INFO_HEAD) - 1) + len + (sizeof(PRODUCT_INFO_TAIL) - 1));
+            for (i = 0; PRODUCT_INFO_HEAD[i]; i++) Tx(PRODUCT_INFO_HEAD[i]);
+            for (i = 0; i < len; i++) Tx(key[i]);
+            for (i = 0; PRODUCT_INFO_TAIL[i]; i++) Tx(PRODUCT_INFO_TAIL[i]);
+            TxEnd();
+            break;
+
+        case OPCODE_QUERY_MCU:
+        case OPCODE_REPORT_NETWORK_STATUS:
+            TxBegin(RxOpcode, 0);
+            TxEnd();
+            break;
+
+        case OPCODE_UPGRADE_START:
+            if (RxLen != 4) break;
+            size = ((uint32_t)RxKeep[0] << 24) | ((uint32_t)RxKeep[1] << 16) |
+                   ((uint16_t)RxKeep[2] << 8) | RxKeep[3];
+            if (size < OTA_IMAGE_MIN || size > OTA_IMAGE_MAX) break;
+            ImageSize = (uint16_t)size;
+            Expected = 0;
+            OtaRecordStore(OTA_RECEIVING, ImageSize);
+            TxBegin(OPCODE_UPGRADE_START, 1);
+            Tx(OTA_PACKAGE_CODE);
+            TxEnd();
+            break;
+
+        case OPCODE_UPGRADE_PACKAGE:
+            if (RxLen >= RX_KEEP) PackageEnd();
+            break;
+
+        default:
+            break;
+    }
+}
+
+void RxByte(uint8_t b)
+{
+    switch (Rx)
+    {
+        case RX_HEADER_1:
+            if (b == HEADER_1) Rx = RX_HEADER_2;
+            RxSum = b;
+            return;
+
+        case RX_HEADER_2:
+            Rx = (b == HEADER_2) ? RX_VERSION_BYTE : RX_HEADER_1;
+            break;
+
+        case RX_VERSION_BYTE:
+            Rx = (b == RX_VERSION) ? RX_OPCODE : RX_HEADER_1;
+            break;
+
+        case RX_OPCODE:
+            RxOpcode = b;
+            Rx = RX_LEN_H;
+            break;
+
+        case RX_LEN_H:
+            RxLen = (uint16_t)b << 8;
+            Rx = RX_LEN_L;
+            break;
+
+        case RX_LEN_L:
+            RxLen |= b;
+            RxAt = 0;
+            PackageTaken = false;
+            Rx = RxLen > RX_LEN_MAX ? RX_HEADER_1 : (RxLen ? RX_PAYLOAD : RX_CHECKSUM);
+            break;
+
+        case RX_PAYLOAD:
+            if (RxOpcode == OPCODE_UPGRADE_PACKAGE) PackageByte(b);
+            if (RxAt < RX_KEEP) RxKeep[RxAt] = b;
+            if (++RxAt == RxLen) Rx = RX_CHECKSUM;
+            break;
+
+        case RX_CHECKSUM:
+            Rx = RX_HEADER_1;
+            if (b == RxSum) Process();
+            return;
+    }
+    RxSum += b;
+}
+
+void main()
+{
+    S_OTA_RECORD record;
+    uint8_t b;
+
+    OtaRecordLoad(&record);
+    if (record.state != OTA_REQUESTED && record.state != OTA_RECEIVING)
+    {
+        HalJumpToApp();
+    }
+
+    HalGpioSetup();
+    HalUartSetup(9600);
+    HalFlashSetup();
+    ImageSize = ((uint16_t)record.size_h << 8) | record.size_l;
+
+    if (record.state == OTA_REQUESTED)
+    {
+        // The application took the 0x0A and reset without answering it.
+        OtaRecordStore(OTA_RECEIVING, ImageSize);
+        TxBegin(OPCODE_UPGRADE_START, 1);
+        Tx(OTA_PACKAGE_CODE);
+        TxEnd();
+    }
+
+    for (;;)
+    {
+        if (SpillTail != SpillHead)
+        {
+            b = Spill[SpillTail];
+            SpillTail = (SpillTail + 1) & SPILL_MASK;
+        }
+        else if (!HalUartPoll(&b))
+        {
+            continue;
+        }
+        RxByte(b);
+    }
+}
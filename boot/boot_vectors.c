@@ -0,0 +1,52 @@
+/*	BOOTLOADER INTERRUPT VECTOR TABLE
+ *	The bootloader runs with interrupts masked, so every entry but reset
+ *	passes straight on to the same entry of the application's table, at
+ *	OTA_APP_BASE (ota.h). Each entry is 4 bytes: INT and a 24-bit address.
+ */
+#include "ota.h"
+
+typedef void @far (*interrupt_handler_t)(void);
+
+struct interrupt_vector {
+	unsigned char interrupt_instruction;
+	interrupt_handler_t interrupt_handler;
+};
+
+extern void _stext();     /* startup routine */
+
+#define APP_VECTOR(n) {0x82, (interrupt_handler_t)(OTA_APP_BASE + 4 * (n))}
+
+struct interrupt_vector const _vectab[] = {
+	{0x82, (interrupt_handler_t)_stext}, /* reset */
+	APP_VECTOR(1),  /* trap  */
+	APP_VECTOR(2),  /* irq0  */
+	APP_VECTOR(3),  /* irq1  */
+	APP_VECTOR(4),  /* irq2  */
+	APP_VECTOR(5),  /* irq3  */
+	APP_VECTOR(6),  /* irq4  */
+	APP_VECTOR(7),  /* irq5  */
+	APP_VECTOR(8),  /* irq6  */
+	APP_VECTOR(9),  /* irq7  */
+	APP_VECTOR(10), /* irq8  */
+	APP_VECTOR(11), /* irq9  */
+	APP_VECTOR(12), /* irq10 */
+	APP_VECTOR(13), /* irq11 */
+	APP_VECTOR(14), /* irq12 */
+	APP_VECTOR(15), /* irq13 */
+	APP_VECTOR(16), /* irq14 */
+	APP_VECTOR(17), /* irq15 */
+	APP_VECTOR(18), /* irq16 */
+	APP_VECTOR(19), /* irq17 */
+	APP_VECTOR(20), /* irq18 */
+	APP_VECTOR(21), /* irq19 */
+	APP_VECTOR(22), /* irq20 */
+	APP_VECTOR(23), /* irq21 */
+	APP_VECTOR(24), /* irq22 */
+	APP_VECTOR(25), /* irq23 */
+	APP_VECTOR(26), /* irq24 */
+	APP_VECTOR(27), /* irq25 */
+	APP_VECTOR(28), /* irq26 */
+	APP_VECTOR(29), /* irq27 */
+	APP_VECTOR(30), /* irq28 */
+	APP_VECTOR(31), /* irq29 */
+};
@@ -0,0 +1,109 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include "hal.h"
+#include "button.h"
+#include "time.h"
+
+typedef enum
+{
+    GESTURE_IDLE,
+    GESTURE_PRESSED,      // First press, waiting for release or long press
+    GESTURE_WAIT_DOUBLE,  // Released, waiting to see if a second press follows
+    GESTURE_SECOND_PRESS, // Double press reported, waiting for release
+    GESTURE_HOLDING       // Long press reported, repeating until release
+} E_GESTURE_STATE;
+
+static bool ButtonDown = false;   // Debounced level
+static E_GESTURE_STATE Gesture = GESTURE_IDLE;
+
+void ButtonSetup(void)
+{
+    HalButtonIrqSetup();
+}
+
+void ISR_EXTI_PORTD(void)
+{
+    // Every edge (bounce included) pushes the sample point out again, so the
+    // level is only read once it has been quiet for BUTTON_DEBOUNCE_MS.
+    TimerStartFromISR(TIMER_BUTTON_DEBOUNCE, BUTTON_DEBOUNCE_MS);
+}
+
+static E_BUTTON_GESTURE OnPress(void)
+{
+    switch (Gesture)
+    {
+        case GESTURE_IDLE:
+            Gesture = GESTURE_PRESSED;
+            TimerStart(TIMER_BUTTON_GESTURE, BUTTON_LONG_PRESS_MS);
+            break;
+
+        case GESTURE_WAIT_DOUBLE:
+            Gesture = GESTURE_SECOND_PRESS;
+            TimerStop(TIMER_BUTTON_GESTURE);
+            return BUTTON_DOUBLE;
+
+        default:
+            break;
+    }
+    return BUTTON_NONE;
+}
+
+static E_BUTTON_GESTURE OnRelease(void)
+{
+    switch (Gesture)
+    {
+        case GESTURE_PRESSED:
+            Gesture = GESTURE_WAIT_DOUBLE;
+            TimerStart(TIMER_BUTTON_GESTURE, BUTTON_DOUBLE_WINDOW_MS);
+            break;
+
+        default:
+            Gesture = GESTURE_IDLE;
+            TimerStop(TIMER_BUTTON_GESTURE);
+            break;
+    }
+    return BUTTON_NONE;
+}
+
+static E_BUTTON_GESTURE OnTimeout(void)
+{
+    switch (Gesture)
+    {
+        case GESTURE_PRESSED:
+            Gesture = GESTURE_HOLDING;
+            TimerStart(TIMER_BUTTON_GESTURE, BUTTON_REPEAT_MS);
+            return BUTTON_LONG;
+
+        case GESTURE_HOLDING:
+            TimerStart(TIMER_BUTTON_GESTURE, BUTTON_REPEAT_MS);
+            return BUTTON_REPEAT;
+
+        case GESTURE_WAIT_DOUBLE:
+            Gesture = GESTURE_IDLE;
+            return BUTTON_SHORT;
+
+        default:
+            break;
+    }
+    return BUTTON_NONE;
+}
+
+E_BUTTON_GESTURE ButtonPopGesture(void)
+{
+    E_BUTTON_GESTURE g = BUTTON_NONE;
+
+    if (TimerExpired(TIMER_BUTTON_DEBOUNCE))
+    {
+        bool down = !GET_BUTTON(); // Active low
+        if (down != ButtonDown)
+        {
+            ButtonDown = down;
+            g = down ? OnPress() : OnRelease();
+        }
+    }
+    if (g == BUTTON_NONE && TimerExpired(TIMER_BUTTON_GESTURE))
+    {
+        g = OnTimeout();
+    }
+    return g;
+}
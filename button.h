@@ -0,0 +1,23 @@
+#pragma once
+#include <stdint.h>
+#include <stdbool.h>
+
+#define BUTTON_DEBOUNCE_MS      20
+#define BUTTON_DOUBLE_WINDOW_MS 300  /* Max gap between the two presses of a double press */
+#define BUTTON_LONG_PRESS_MS    3000
+#define BUTTON_REPEAT_MS        1000 /* While still held after a long press */
+
+typedef enum
+{
+    BUTTON_NONE,
+    BUTTON_SHORT,   // Pressed and released, and not pressed again within the double window
+    BUTTON_DOUBLE,  // Pressed twice within the double window
+    BUTTON_LONG,    // Held for BUTTON_LONG_PRESS_MS
+    BUTTON_REPEAT   // Still held, every BUTTON_REPEAT_MS after BUTTON_LONG
+} E_BUTTON_GESTURE;
+
+void ButtonSetup(void);
+
+E_BUTTON_GESTURE ButtonPopGesture(void);
+
+void ISR_EXTI_PORTD(void);
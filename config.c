@@ -0,0 +1,111 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include "hal.h"
+#include "config.h"
+#include "ota.h"
+#include "time.h"
+
+#define CONFIG_WORDS (sizeof(S_CONFIG) / HAL_EEPROM_WORD)
+
+S_CONFIG Config;
+
+static uint8_t Current = CONFIG_COPIES - 1; // Copy Config came from, or last went to
+static HAL_NEAR S_CONFIG Saving;            // What's being written
+static uint8_t SavingCopy;
+static uint8_t SaveAt;                      // Next word of it
+static bool SavePending = false;
+
+static uint8_t CopyOffset(uint8_t copy)
+{
+    return CONFIG_OFFSET + copy * sizeof(S_CONFIG);
+}
+
+static uint16_t Crc(const S_CONFIG* c)
+{
+    const uint8_t* p = (const uint8_t*)c;
+    uint16_t crc = 0xFFFF;
+    uint8_t i;
+
+    for (i = 0; i < sizeof(S_CONFIG) - sizeof(c->crc); i++)
+    {
+        crc = OtaCrc16(crc, p[i]);
+    }
+    return crc;
+}
+
+void ConfigLoad(void)
+{
+    S_CONFIG c;
+    const uint8_t* src;
+    bool found = false;
+    uint8_t copy;
+    uint8_t i;
+
+    for (copy = 0; copy < CONFIG_COPIES; copy++)
+    {
+        src = HAL_EEPROM(CopyOffset(copy));
+        for (i = 0; i < sizeof(c); i++)
+        {
+            ((uint8_t*)&c)[i] = src[i];
+        }
+        if (c.version != CONFIG_VERSION || c.crc != Crc(&c)) continue;
+        if (found && (int8_t)(c.seq - Config.seq) <= 0) continue;
+        Config = c;
+        Current = copy;
+        found = true;
+    }
+    if (found) return;
+
+    Config.version = CONFIG_VERSION;
+    Config.seq = 0;
+    Config.lockdown = false;
+    Config.travel_s = CONFIG_TRAVEL_S;
+    Config.auto_close_s = CONFIG_AUTO_CLOSE_S;
+    Config.relay_ms = CONFIG_RELAY_MS;
+    Config.spare = 0;
+}
+
+void ConfigSave(void)
+{
+    Saving = Config;
+    Saving.seq = Config.seq + 1;
+    Saving.crc = Crc(&Saving);
+    SavingCopy = (Current + 1) % CONFIG_COPIES;
+    SaveAt = 0;
+    SavePending = true;
+}
+
+void ConfigTask(void)
+{
+    const uint8_t* word;
+    const uint8_t* cells;
+
+    if (!SavePending) return;
+    if (HalEepromBusy())
+    {
+        TimerStart(TIMER_EEPROM, 1); // Look again
+        return;
+    }
+
+    // Words that already hold the right bytes are left alone, which is also
+    // how the last one is seen to have gone in.
+    for (; SaveAt < CONFIG_WORDS; SaveAt++)
+    {
+        word = (const uint8_t*)&Saving + SaveAt * HAL_EEPROM_WORD;
+        cells = HAL_EEPROM(CopyOffset(SavingCopy) + SaveAt * HAL_EEPROM_WORD);
+        if (word[0] != cells[0] || word[1] != cells[1] ||
+            word[2] != cells[2] || word[3] != cells[3]) break;
+    }
+    if (SaveAt == CONFIG_WORDS)
+    {
+        SavePending = false;
+        Current = SavingCopy;
+        Config.seq = Saving.seq;
+        return;
+    }
+
+    HalEepromWriteWord(CopyOffset(SavingCopy) + SaveAt * HAL_EEPROM_WORD,
+                       (const uint8_t*)&Saving + SaveAt * HAL_EEPROM_WORD);
+    SaveAt++;
+    TimerStart(TIMER_EEPROM, HAL_EEPROM_WORD_MS);
+}
@@ -0,0 +1,49 @@
+#pragma once
+#include <stdint.h>
+#include <stdbool.h>
+
+// Settings kept in data EEPROM, so a brown-out doesn't lose them: lockdown
+// and the door timings. The cloud sets them through the DP_SAVE datapoints
+// (datapoints.h), the button sets lockdown.
+//
+// There are two copies, each with its own sequence number and CRC, and a
+// save always goes to the older one: a save cut short by a power loss leaves
+// the other one to boot from. A copy of another version, or with a bad CRC,
+// is passed over; with neither usable, the defaults apply.
+#define CONFIG_OFFSET 4 // After the OTA record (ota.h), word aligned
+#define CONFIG_COPIES 2
+#define CONFIG_VERSION 1
+
+// Defaults, and the range a datapoint write must fall in.
+#define CONFIG_TRAVEL_S 20       /* Actual time: 13.7s */
+#define CONFIG_TRAVEL_S_MIN 5
+#define CONFIG_TRAVEL_S_MAX 60
+#define CONFIG_AUTO_CLOSE_S 120  // Open this long, plus a travel time, before it's closed
+#define CONFIG_AUTO_CLOSE_S_MIN 10
+#define CONFIG_AUTO_CLOSE_S_MAX 3600
+#define CONFIG_RELAY_MS 1000     /* Original firmware uses about 3 s */
+#define CONFIG_RELAY_MS_MIN 100
+#define CONFIG_RELAY_MS_MAX 3000
+
+// As stored: a whole number of EEPROM words, 16-bit fields aligned.
+typedef struct
+{
+    uint8_t version;       // CONFIG_VERSION
+    uint8_t seq;           // The newer copy is the one ahead
+    uint8_t lockdown;      // Cloud OPEN commands are ignored
+    uint8_t travel_s;      // Longest a door move is waited for
+    uint16_t auto_close_s;
+    uint16_t relay_ms;     // Motor switch press
+    uint16_t spare;        // 0
+    uint16_t crc;          // OtaCrc16() of everything before it
+} S_CONFIG;
+
+void ConfigLoad(void);
+
+// Stores Config. Only starts it: ConfigTask() writes it out a word at a
+// time, and a save made meanwhile starts over with the newer values.
+void ConfigSave(void);
+
+void ConfigTask(void);
+
+extern S_CONFIG Config;
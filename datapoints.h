@@ -0,0 +1,48 @@
+#pragma once
+
+// Datapoint schema. Everything the firmware exchanges with the cloud is
+// declared here once; tuya.c expands the list into the DP_<name> indices, the
+// DPID_<name> ids and the flash table that the encoder and decoder run from.
+//
+//   X(name, dpid, type, flags, min, max, var, on_write)
+//
+//   type      Tuya type, without the TUYA_TYPE_ prefix
+//   flags     DP_QUERY: reported in answer to OPCODE_QUERY_STATUS
+//             DP_WRITE: the cloud may set it
+//             DP_REQUEST: a write of anything only asks for it to be reported
+//             DP_SAVE: a write is kept across resets (config.h); an
+//             on_write saves it itself
+//   min, max  Range a write must fall in (integer types only)
+//   var       Backing variable. Its size is the value's size: 1, 2 or 4 bytes
+//             for integer types, the whole array for raw and string.
+//   on_write  Called with the written value instead of storing it, or 0.
+//             For DP_REQUEST, called with it before the report.
+//
+// Rows are reported in this order when several go in one frame.
+#define TUYA_DATAPOINTS(X) \
+    X(ALARM,    0x65, BOOL,   0,                  0, 1, DoorOpen, 0)           /* Sends alarm/notification */ \
+    X(DOOR,     0x01, BOOL,   DP_QUERY | DP_WRITE, 0, 1, DoorOpen, DoorCommand) /* 1 = open/opening, 0 = closed */ \
+    X(STOCK_EX, 0x07, UINT32, DP_QUERY,           0, 0, StockEx,  0)           /* What the stock firmware reports. Must be sent, or querying doesn't work. */ \
+    X(LATENCY,  0x66, RAW,    DP_REQUEST,         0, 0, Latency,  0)           /* S_LATENCY, see latency.h */ \
+    X(EVENTLOG, 0x67, RAW,    DP_REQUEST,         0, 0, EventLogPage, EventLogSelect) /* Write a page number: S_EVENTLOG_PAGE, see eventlog.h */ \
+    X(LOCKDOWN, 0x68, BOOL,   DP_QUERY | DP_WRITE | DP_SAVE, 0, 1, Config.lockdown, LockdownCommand) /* Cloud OPEN commands are ignored */ \
+    X(AUTO_CLOSE, 0x69, UINT32, DP_WRITE | DP_SAVE, CONFIG_AUTO_CLOSE_S_MIN, CONFIG_AUTO_CLOSE_S_MAX, Config.auto_close_s, 0) /* s */ \
+    X(TRAVEL,   0x6A, UINT32, DP_WRITE | DP_SAVE, CONFIG_TRAVEL_S_MIN, CONFIG_TRAVEL_S_MAX, Config.travel_s, 0) /* s, the longest a door move is waited for */ \
+    X(RELAY,    0x6B, UINT32, DP_WRITE | DP_SAVE, CONFIG_RELAY_MS_MIN, CONFIG_RELAY_MS_MAX, Config.relay_ms, 0) /* ms, motor switch press */
+
+// The timing rows aren't DP_QUERY: the answer to a status query is 25 bytes
+// as it is, and they would make it 49 of the TX ring's 63, with a heartbeat
+// reply or a store-and-forward replay (up to 47) likely still going out ahead
+// of it. The cloud keeps what it wrote.
+
+enum
+{
+    DP_QUERY = 1 << 0,
+    DP_WRITE = 1 << 1,
+    DP_REQUEST = 1 << 2,
+    DP_SAVE = 1 << 3
+};
+
+// Product info, sent as {"p":"<key from flash>","v":"<version>","m":<mode>}
+#define TUYA_PRODUCT_VERSION "1.0.0"
+#define TUYA_PRODUCT_MODE    "0" // Module self-processing mode (no reset pin to the module)
@@ -0,0 +1,60 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include "hal.h"
+#include "event.h"
+
+// Event queue: filled by ISRs and tasks, drained by the state machine.
+// There is a single producer at a time: ISRs don't nest on this part (they
+// all run at the same software priority), and EventPost() masks interrupts
+// for the few stores it does. Only the producer writes EventHead and only
+// EventPop() writes EventTail, so the consumer side needs no lock.
+//
+// The last EVENT_TIMER_SLOTS free slots are kept for timer expiries, one per
+// timer in TIMER_EVENTS (time.h), so a burst of commands, edges or gestures
+// can't push one out of order.
+#define EVENT_RING_SIZE 16 /* must be a power of 2 */
+#define EVENT_RING_MASK (EVENT_RING_SIZE - 1)
+#define EVENT_TIMER_SLOTS 3
+
+static HAL_NEAR S_EVENT EventRing[EVENT_RING_SIZE];
+static volatile uint8_t EventHead = 0;
+static volatile uint8_t EventTail = 0;
+
+uint16_t EventsLost = 0;
+
+bool EventPostFromISR(uint8_t type, uint8_t arg, uint8_t seq, uint32_t ms)
+{
+    uint8_t next = (EventHead + 1) & EVENT_RING_MASK;
+    S_EVENT* e = &EventRing[EventHead];
+
+    if (next == EventTail ||
+        (type != EVENT_TIMER && ((EventTail - next) & EVENT_RING_MASK) <= EVENT_TIMER_SLOTS))
+    {
+        EventsLost++;
+        return false;
+    }
+    e->ms = ms;
+    e->type = type;
+    e->arg = arg;
+    e->seq = seq;
+    EventHead = next; // Publish only once the slot is complete
+    return true;
+}
+
+bool EventPost(uint8_t type, uint8_t arg, uint32_t ms)
+{
+    bool posted;
+
+    INTERRUPT_DIS();
+    posted = EventPostFromISR(type, arg, 0, ms);
+    INTERRUPT_EN();
+    return posted;
+}
+
+bool EventPop(S_EVENT* e)
+{
+    if (EventTail == EventHead) return false;
+    *e = EventRing[EventTail];
+    EventTail = (EventTail + 1) & EVENT_RING_MASK;
+    return true;
+}
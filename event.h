@@ -0,0 +1,37 @@
+#pragma once
+#include <stdint.h>
+#include <stdbool.h>
+
+// Everything the state machine reacts to arrives as one of these, in order.
+typedef enum
+{
+    EVENT_NONE,      // Re-evaluate the state; posted by no one
+    EVENT_CMD_OPEN,  // arg: E_EVENT_SOURCE
+    EVENT_CMD_CLOSE, // arg: E_EVENT_SOURCE
+    EVENT_SENSOR,    // arg: 1 = door open, 0 = closed
+    EVENT_BUTTON,    // arg: E_BUTTON_GESTURE
+    EVENT_TIMER      // arg: timer handle, seq: TimerGeneration() when it fired
+} E_EVENT;
+
+typedef enum
+{
+    EVENT_SRC_CLOUD,
+    EVENT_SRC_BUTTON
+} E_EVENT_SOURCE;
+
+typedef struct
+{
+    uint32_t ms;  // When it happened, in get_milliseconds_now() time
+    uint8_t type; // E_EVENT
+    uint8_t arg;
+    uint8_t seq;
+} S_EVENT;
+
+// Must be called with interrupts masked, i.e. from an ISR.
+bool EventPostFromISR(uint8_t type, uint8_t arg, uint8_t seq, uint32_t ms);
+
+bool EventPost(uint8_t type, uint8_t arg, uint32_t ms);
+
+bool EventPop(S_EVENT* e);
+
+extern uint16_t EventsLost;
@@ -0,0 +1,119 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include "hal.h"
+#include "eventlog.h"
+#include "time.h"
+
+#define EVENTLOG_QUEUE_MASK (EVENTLOG_QUEUE - 1)
+
+// Records waiting for the EEPROM, oldest at QueueTail. Only the main loop
+// puts and takes, so no locking.
+static HAL_NEAR S_EVENTLOG_RECORD Queue[EVENTLOG_QUEUE];
+static uint8_t QueueHead = 0;
+static uint8_t QueueTail = 0;
+
+static uint8_t Head = 0;    // Slot written next
+static uint8_t NextSeq = 1;
+static uint8_t Lost = 0;
+static uint32_t LastPut = 0; // get_milliseconds_now() of the last record queued
+
+HAL_NEAR S_EVENTLOG_PAGE EventLogPage;
+
+static const S_EVENTLOG_RECORD* Slots(void)
+{
+    return (const S_EVENTLOG_RECORD*)HAL_EEPROM(EVENTLOG_OFFSET);
+}
+
+static uint8_t SeqAfter(uint8_t seq)
+{
+    return seq == 0xFF ? 1 : seq + 1;
+}
+
+// The inverse of EVENTLOG_GAP_S(), rounding down.
+static uint8_t Gap(uint32_t s)
+{
+    uint8_t exp;
+
+    if (s < 8) return (uint8_t)s;
+    for (exp = 1; s >= 16; exp++)
+    {
+        s >>= 1;
+    }
+    return (exp << 3) | (uint8_t)(s - 8);
+}
+
+void EventLogSetup(void)
+{
+    const S_EVENTLOG_RECORD* slots = Slots();
+    uint8_t i;
+    uint8_t seq;
+
+    // The head is the first slot that doesn't follow on from a written one
+    // before it. A power cut mid-write can leave any slot blank, slot 0
+    // included, so a blank one only ends the log where a record precedes it.
+    for (i = 0; i < EVENTLOG_SLOTS; i++)
+    {
+        seq = slots[(i + EVENTLOG_SLOTS - 1) % EVENTLOG_SLOTS].seq;
+        if (seq && slots[i].seq != SeqAfter(seq))
+        {
+            Head = i;
+            NextSeq = SeqAfter(seq);
+            break;
+        }
+    }
+    EventLogPut(EVENTLOG_BOOT, 0);
+}
+
+void EventLogPut(uint8_t type, uint8_t arg)
+{
+    uint8_t next = (QueueHead + 1) & EVENTLOG_QUEUE_MASK;
+    S_EVENTLOG_RECORD* r = &Queue[QueueHead];
+    uint32_t now = get_milliseconds_now();
+
+    if (next == QueueTail)
+    {
+        if (Lost != 0xFF) Lost++;
+        return;
+    }
+    r->type = type;
+    r->arg = arg;
+    r->gap = Gap((now - LastPut) / 1000);
+    LastPut = now;
+    QueueHead = next;
+}
+
+void EventLogTask(void)
+{
+    S_EVENTLOG_RECORD* r = &Queue[QueueTail];
+
+    if (QueueTail == QueueHead) return;
+    if (HalEepromBusy())
+    {
+        TimerStart(TIMER_EEPROM, 1); // Look again
+        return;
+    }
+
+    r->seq = NextSeq;
+    HalEepromWriteWord(EVENTLOG_OFFSET + Head * sizeof(S_EVENTLOG_RECORD), (const uint8_t*)r);
+    NextSeq = SeqAfter(NextSeq);
+    Head = (Head + 1) % EVENTLOG_SLOTS;
+    QueueTail = (QueueTail + 1) & EVENTLOG_QUEUE_MASK;
+
+    // One word at a time, so the loop is never held up by more than one.
+    if (QueueTail != QueueHead) TimerStart(TIMER_EEPROM, HAL_EEPROM_WORD_MS);
+}
+
+void EventLogSelect(uint32_t page)
+{
+    const S_EVENTLOG_RECORD* slots = Slots();
+    uint8_t i;
+
+    if (page >= EVENTLOG_PAGES) page = 0;
+    EventLogPage.page = (uint8_t)page;
+    EventLogPage.head = Head;
+    EventLogPage.lost = Lost;
+    for (i = 0; i < EVENTLOG_PAGE_SLOTS; i++)
+    {
+        EventLogPage.records[i] = slots[page * EVENTLOG_PAGE_SLOTS + i];
+    }
+}
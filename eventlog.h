@@ -0,0 +1,70 @@
+#pragma once
+#include <stdint.h>
+#include <stdbool.h>
+#include "hal.h"
+
+// Event log in data EEPROM, kept across power cycles for field forensics:
+// door moves the unit made, retries, errors, lockdown toggles and Wi-Fi
+// resets. Records are one EEPROM word each and go round a ring of
+// EVENTLOG_SLOTS, so every slot is rewritten once a lap. The newest record is
+// found at boot by its sequence number; 0 marks a slot never written, as
+// blank EEPROM reads.
+//
+// EventLogPut() only queues. EventLogTask() writes one record per
+// HAL_EEPROM_WORD_MS as a single word program and doesn't wait for it.
+//
+// Read back through raw datapoint 0x67 (see datapoints.h): writing a page
+// number has S_EVENTLOG_PAGE reported for it. Records still queued aren't in
+// it yet.
+#define EVENTLOG_OFFSET 32     // Below it: the OTA record (ota.h) and the config (config.h)
+#define EVENTLOG_SLOTS 24      // To the end of the 128 bytes
+#define EVENTLOG_PAGE_SLOTS 8
+#define EVENTLOG_PAGES (EVENTLOG_SLOTS / EVENTLOG_PAGE_SLOTS)
+#define EVENTLOG_QUEUE 4       /* must be a power of 2 */
+
+typedef enum
+{
+    EVENTLOG_BOOT = 1,
+    EVENTLOG_OPENED,      // arg: tenths of a second from the press to the sensor edge
+    EVENTLOG_CLOSED,      // arg: likewise
+    EVENTLOG_CLOSE_RETRY, // arg: attempts left
+    EVENTLOG_OPEN_ERROR,
+    EVENTLOG_CLOSE_ERROR,
+    EVENTLOG_LOCKDOWN,    // arg: 1 = on
+    EVENTLOG_WIFI_RESET   // arg: pairing mode asked for
+} E_EVENTLOG;
+
+// A record's gap is the time since the one before it, in seconds on a log
+// scale: 5 bits of exponent, 3 of mantissa, so it's within 12.5% however long
+// the unit sat idle. Up to 7 s it's exact. A BOOT record's is 0, as the clock
+// starts over; the one after counts from it. Gaps longer than the 49-day span
+// of the millisecond clock read short.
+#define EVENTLOG_GAP_S(gap) ((gap) < 8 ? (uint32_t)(gap) : (8UL + ((gap) & 7)) << (((gap) >> 3) - 1))
+
+typedef struct
+{
+    uint8_t seq;  // 1..255, then 1 again
+    uint8_t type; // E_EVENTLOG
+    uint8_t arg;
+    uint8_t gap;  // See EVENTLOG_GAP_S()
+} S_EVENTLOG_RECORD;
+
+// The datapoint's wire layout.
+typedef struct
+{
+    uint8_t page;
+    uint8_t head; // Slot written next: the oldest record once the ring is full
+    uint8_t lost; // Records dropped because the queue was full, saturating
+    uint8_t spare;
+    S_EVENTLOG_RECORD records[EVENTLOG_PAGE_SLOTS]; // Slots page * EVENTLOG_PAGE_SLOTS on
+} S_EVENTLOG_PAGE;
+
+void EventLogSetup(void);
+
+void EventLogPut(uint8_t type, uint8_t arg);
+
+void EventLogTask(void);
+
+void EventLogSelect(uint32_t page); // datapoints.h on_write
+
+extern HAL_NEAR S_EVENTLOG_PAGE EventLogPage;
@@ -0,0 +1,74 @@
+#pragma once
+#include <stdint.h>
+#include <stdbool.h>
+
+// Hardware abstraction. The firmware only reaches the board through these:
+//
+//   INTERRUPT_EN(), INTERRUPT_DIS(), WAIT_FOR_INTERRUPT()
+//   BLUE_LED_ON/OFF(), RED_LED_ON/OFF(), LED_OFF(), RELAY_CLOSE/OPEN()
+//   GET_SENSOR_BOOL() (1 when open), GET_BUTTON() (0 when pressed)
+//   HAL_UART_STATUS(), HAL_UART_OVERRUN, HAL_UART_FRAMING, HAL_UART_READ(),
+//   HAL_UART_WRITE(b),
+//   HAL_UART_TX_IRQ_ON(), HAL_UART_TX_IRQ_OFF()
+//   HAL_TICK_ACK()
+//   HAL_PRODUCT_KEY
+//   HAL_CYCLES_T (wraps, so only differences mean anything), HAL_CYCLES_MAX
+//   HAL_FLASH(addr), HAL_EEPROM(offset): read pointers into program memory
+//   and data EEPROM
+//   HAL_NEAR: storage class for the large buffers. Globals go to the 256-byte
+//   zero page by default, which the small hot ones fill; these go above it
+//
+// and the setup functions below. The STM8 backend (hal_stm8.h/.c) maps the
+// per-byte and per-tick ones straight onto registers, so they cost what the
+// register accesses did. The host backend (host/) emulates them on Linux, and
+// is selected by building with HAL_HOST defined.
+#ifdef HAL_HOST
+#include "host/hal_host.h"
+#else
+#include "hal_stm8.h"
+#endif
+
+void HalGpioSetup(void);
+
+void HalUartSetup(uint16_t baud);
+
+void HalTickSetup(void); // 1 ms ISR_TIM4_UPDATE()
+
+void HalSensorIrqSetup(void); // ISR_EXTI_PORTC() on both edges
+
+void HalButtonIrqSetup(void); // ISR_EXTI_PORTD() on both edges
+
+void HalCyclesSetup(void); // Starts the HalCycles() counter
+
+HAL_CYCLES_T HalCycles(void);
+
+// Memory programming, the polled UART and resets, for the bootloader and the
+// OTA hand-off (ota.h). They run with interrupts masked.
+#define HAL_FLASH_BLOCK 64
+
+void HalFlashSetup(void); // Before HalFlashProgramBlock(); bootloader only
+
+// Erases and programs one block of program memory; addr must be block
+// aligned. The UART can't be serviced by interrupt meanwhile, so any bytes
+// arriving during the write are polled into rx, up to rx_max. Returns how
+// many.
+uint8_t HalFlashProgramBlock(uint16_t addr, const uint8_t* data, uint8_t* rx, uint8_t rx_max);
+
+void HalEepromWrite(uint8_t offset, const uint8_t* data, uint8_t len);
+
+// Starts programming one word of data EEPROM and returns without waiting for
+// it; offset must be word aligned. HalEepromBusy() until it's done.
+#define HAL_EEPROM_WORD 4
+#define HAL_EEPROM_WORD_MS 7 // Erase and write, with some slack
+
+void HalEepromWriteWord(uint8_t offset, const uint8_t* data);
+
+bool HalEepromBusy(void);
+
+bool HalUartPoll(uint8_t* b); // A received byte, if there is one
+
+void HalUartPut(uint8_t b);   // Waits for room
+
+void HalReset(void);          // Never returns
+
+void HalJumpToApp(void);      // To the application's reset vector; never returns
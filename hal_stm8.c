@@ -0,0 +1,197 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include "hal.h"
+
+#define TIM4_PRESCALER_16 4   /* 2 MHz / 16 = 125 kHz */
+#define TIM4_AUTO_RELOAD 124  /* 125 kHz / (124 + 1) = 1 kHz */
+
+enum {
+    BIT_0 = 1 << 0,
+    BIT_1 = 1 << 1,
+    BIT_2 = 1 << 2,
+    BIT_3 = 1 << 3,
+    BIT_4 = 1 << 4,
+    BIT_5 = 1 << 5,
+    BIT_6 = 1 << 6,
+    BIT_7 = 1 << 7
+};
+
+enum {
+    TIM2_CR1_ENABLE = BIT_0,
+    TIM2_CR1_AUTORELOAD = BIT_7,
+    TIM2_CCMR_OUTPUT_TOGGLE_MODE = BIT_5 | BIT_4,
+    TIM2_CCER1_CC2E = BIT_4,
+    TIM2_IER_CC1IE = BIT_1,
+    TIM2_IER_UIE = BIT_0,
+    TIM2_EGR_UG = BIT_0,
+    TIM1_CR1_ENABLE = BIT_0,
+    TIM1_EGR_UG = BIT_0,
+    TIM4_CR1_ENABLE = BIT_0,
+    TIM4_CR1_AUTORELOAD = BIT_7,
+    TIM4_IER_UIE = BIT_0,
+    TIM4_SR_UIF = BIT_0,
+    FLASH_CR2_WPRG = BIT_6,
+    FLASH_IAPSR_WR_PG_DIS = BIT_0,
+    FLASH_IAPSR_EOP = BIT_2,
+    FLASH_IAPSR_DUL = BIT_3,
+    WWDG_CR_WDGA = BIT_7,
+    TIM_PRESCALER_16384 = 0xE,
+//    TIM_PRESCALER_8192 = 0xD,
+//    TIM_PRESCALER_4096 = 0xC,
+    TIM_PRESCALER_2048 = 0xB
+//    TIM_PRESCALER_1024 = 0xA
+};
+
+#define FLASH_DUKR_KEY1 0xAE
+#define FLASH_DUKR_KEY2 0x56
+
+enum {
+    EXTI_CR1_PCIS_BOTH = (3 << 4), // Port C: rising and falling edge
+    EXTI_CR1_PDIS_BOTH = (3 << 6)  // Port D: rising and falling edge
+};
+
+void HalGpioSetup(void)
+{
+    LED_OFF();
+    PD_ODR  |= UART_TX_PIN;
+    PD_DDR  |= (BLUE_LED_PIN | RED_LED_PIN | UART_TX_PIN);
+    PC_DDR  |= DOOR_SWITCH_PIN;
+    PC_CR1  |= DOOR_SWITCH_PIN;
+    PD_CR1  |= (UART_TX_PIN ); 
+}
+
+void HalUartSetup(uint16_t baud)
+{
+    // Set baud registers:
+    const uint16_t uart_div = FCLK_FREQ / baud;
+
+    UART1_BRR1 = (uart_div >> 4) & 0xFF;
+    UART1_BRR2 = uart_div & 0xF | ((uart_div >> 12) << 4);
+
+    UART1_SR &= ~UART1_SR_RXNE; // ack any would-be junk char in the uart.
+    UART1_CR2 = UART1_CR2_REN | UART1_CR2_TEN | UART1_CR2_RIEN;
+}
+
+void HalTickSetup(void)
+{
+    TIM4_PSCR = TIM4_PRESCALER_16;
+    TIM4_ARR = TIM4_AUTO_RELOAD;
+    TIM4_EGR = TIM2_EGR_UG; // Reset timer, and apply the prescaler.
+    TIM4_SR = 0;
+    TIM4_IER = TIM4_IER_UIE;
+    TIM4_CR1 = TIM4_CR1_ENABLE | TIM4_CR1_AUTORELOAD; // Enable the timer
+}
+
+void HalSensorIrqSetup(void)
+{
+    // PC6 is a floating input; CR2 enables its external interrupt.
+    // EXTI_CR1 is only writable while interrupts are still masked.
+    PC_CR2 |= DOOR_SENSOR_PIN;
+    EXTI_CR1 |= EXTI_CR1_PCIS_BOTH;
+}
+
+void HalButtonIrqSetup(void)
+{
+    // PD4 is a floating input; CR2 enables its external interrupt.
+    // EXTI_CR1 is only writable while interrupts are still masked.
+    PD_CR2 |= BUTTON_PIN;
+    EXTI_CR1 |= EXTI_CR1_PDIS_BOTH;
+}
+
+void HalCyclesSetup(void)
+{
+    // Free-running over the full 16 bits, no prescaler: one count per cycle.
+    TIM1_PSCRH = 0;
+    TIM1_PSCRL = 0;
+    TIM1_ARRH = 0xFF;
+    TIM1_ARRL = 0xFF;
+    TIM1_EGR = TIM1_EGR_UG;
+    TIM1_CR1 = TIM1_CR1_ENABLE;
+}
+
+HAL_CYCLES_T HalCycles(void)
+{
+    // The high byte has to be read first: that latches the low one.
+    uint8_t high = TIM1_CNTRH;
+    return ((uint16_t)high << 8) | TIM1_CNTRL;
+}
+
+static bool EepromWriting = false; // A word write was started and not yet seen to end
+
+void HalEepromWrite(uint8_t offset, const uint8_t* data, uint8_t len)
+{
+    uint8_t* dst = (uint8_t*)HAL_EEPROM(offset);
+
+    while (HalEepromBusy());
+    FLASH_DUKR = FLASH_DUKR_KEY1;
+    FLASH_DUKR = FLASH_DUKR_KEY2;
+    while (!(FLASH_IAPSR & FLASH_IAPSR_DUL));
+
+    while (len--)
+    {
+        if (*dst != *data) // Spare the cells a write that changes nothing
+        {
+            *dst = *data;
+            while (!(FLASH_IAPSR & FLASH_IAPSR_EOP));
+        }
+        dst++;
+        data++;
+    }
+
+    FLASH_IAPSR &= ~FLASH_IAPSR_DUL;
+}
+
+void HalEepromWriteWord(uint8_t offset, const uint8_t* data)
+{
+    uint8_t* dst = (uint8_t*)HAL_EEPROM(offset);
+
+    FLASH_DUKR = FLASH_DUKR_KEY1;
+    FLASH_DUKR = FLASH_DUKR_KEY2;
+    while (!(FLASH_IAPSR & FLASH_IAPSR_DUL));
+
+    // All four bytes go in one programming cycle, which starts on the last.
+    FLASH_CR2 = FLASH_CR2_WPRG;
+    FLASH_NCR2 = (uint8_t)~FLASH_CR2_WPRG;
+    dst[0] = data[0];
+    dst[1] = data[1];
+    dst[2] = data[2];
+    dst[3] = data[3];
+    EepromWriting = true;
+}
+
+bool HalEepromBusy(void)
+{
+    // Reading IAPSR clears EOP, so it's only looked at here.
+    if (!EepromWriting) return false;
+    if (!(FLASH_IAPSR & (FLASH_IAPSR_EOP | FLASH_IAPSR_WR_PG_DIS))) return true;
+    EepromWriting = false;
+    FLASH_IAPSR &= ~FLASH_IAPSR_DUL;
+    return false;
+}
+
+bool HalUartPoll(uint8_t* b)
+{
+    if (!(UART1_SR & UART1_SR_RXNE)) return false;
+    *b = UART1_DR;
+    return true;
+}
+
+void HalUartPut(uint8_t b)
+{
+    while (!(UART1_SR & UART1_SR_TXE));
+    UART1_DR = b;
+}
+
+void HalReset(void)
+{
+    // Enabling the window watchdog with T6 clear resets on the spot.
+    WWDG_CR = WWDG_CR_WDGA;
+    for (;;);
+}
+
+void HalJumpToApp(void)
+{
+    // The application's vector table starts with its reset vector
+    // (OTA_APP_BASE in ota.h).
+    __asm("JPF $8800");
+}
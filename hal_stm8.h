@@ -0,0 +1,77 @@
+#pragma once
+#include <iostm8s003.h>
+
+#define FCLK_FREQ        2000000
+
+#define INTERRUPT_EN()   __asm("RIM")
+#define INTERRUPT_DIS()  __asm("SIM")
+#define WAIT_FOR_INTERRUPT() __asm("WFI") // Unmasks interrupts as it stops the core
+
+#define BLUE_LED_PIN      (1 << 2)
+#define BLUE_LED_PORT      PD_ODR
+#define RED_LED_PIN       (1 << 3)
+#define RED_LED_PORT       PD_ODR
+#define DOOR_SENSOR_PIN   (1 << 6)
+#define DOOR_SENSOR_PORT   PC_IDR
+#define DOOR_SWITCH_PIN   (1 << 3)
+#define DOOR_SWITCH_PORT   PC_ODR
+#define BUTTON_PIN        (1 << 4)
+#define BUTTON_PORT       PD_IDR
+
+
+#define BLUE_LED_ON()   BLUE_LED_PORT &= ~BLUE_LED_PIN
+#define BLUE_LED_OFF()  BLUE_LED_PORT |=  BLUE_LED_PIN
+
+#define RED_LED_ON()    RED_LED_PORT &= ~RED_LED_PIN
+#define RED_LED_OFF()   RED_LED_PORT |=  RED_LED_PIN
+
+#define LED_OFF()       (BLUE_LED_PORT |=  RED_LED_PIN | BLUE_LED_PIN)
+#define RELAY_CLOSE()   (DOOR_SWITCH_PORT |=  DOOR_SWITCH_PIN)
+#define RELAY_OPEN()    (DOOR_SWITCH_PORT &= ~DOOR_SWITCH_PIN)
+
+#define GET_SENSOR()    (DOOR_SENSOR_PORT & DOOR_SENSOR_PIN)
+#define GET_BUTTON()    (BUTTON_PORT & BUTTON_PIN)
+
+#define GET_SENSOR_BOOL()  (!!(GET_SENSOR()))
+
+#define UART_TX_PIN     (1 << 5)
+#define UART_RX_PIN     (1 << 6)
+
+enum {
+    UART1_SR_FE   = (1<<1),
+    UART1_SR_OR   = (1<<3),
+    UART1_SR_RXNE = (1<<5),
+    UART1_SR_TXE  = (1<<7)
+};
+
+enum {
+    UART1_CR2_REN  = (1<<2),
+    UART1_CR2_TEN  = (1<<3),
+    UART1_CR2_RIEN = (1<<5),
+    UART1_CR2_TIEN = (1<<7)
+};
+
+// Reading the status then the data register clears both RXNE and OR.
+#define HAL_UART_STATUS()      UART1_SR
+#define HAL_UART_OVERRUN       UART1_SR_OR
+#define HAL_UART_FRAMING       UART1_SR_FE
+#define HAL_UART_READ()        UART1_DR
+#define HAL_UART_WRITE(b)      (UART1_DR = (b)) // Clears TXE
+#define HAL_UART_TX_IRQ_ON()   (UART1_CR2 |= UART1_CR2_TIEN) // TXE is set while idle, so this fires right away.
+#define HAL_UART_TX_IRQ_OFF()  (UART1_CR2 &= ~UART1_CR2_TIEN)
+
+#define HAL_TICK_ACK()         (TIM4_SR = 0)
+
+// Cosmic +mods0 puts globals in the zero page; this is the rest of RAM. The
+// .data/.bss segments run 0x100-0x35F (firmware.stp), about 490 bytes of them
+// used, 590 with TRACE, leaving 0x360-0x3FF to the stack.
+#define HAL_NEAR @near
+
+typedef uint16_t HAL_CYCLES_T; // TIM1 counts fMASTER, which is the CPU clock
+#define HAL_CYCLES_MAX 0xFFFF
+
+#define HAL_FLASH(addr)    ((const uint8_t*)(addr))
+#define HAL_EEPROM(offset) ((const uint8_t*)(0x4000 + (offset)))
+
+#define PRODUCT_KEY_ADDR 0x9A58 // This is where the key is located in the stock firmware.
+#define HAL_PRODUCT_KEY  ((const char*)PRODUCT_KEY_ADDR)
@@ -0,0 +1,64 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include "hal.h"
+
+// Program memory block writes, for the bootloader only: the routine has to
+// run from RAM, and only the bootloader's link sets that up.
+
+enum {
+    FLASH_CR2_PRG = (1 << 0),         // Standard block programming: erase, then write
+    FLASH_IAPSR_WR_PG_DIS = (1 << 0), // Write to a protected page attempted
+    FLASH_IAPSR_PUL = (1 << 1),
+    FLASH_IAPSR_EOP = (1 << 2),
+    FLASH_PUKR_KEY1 = 0x56,
+    FLASH_PUKR_KEY2 = 0xAE
+};
+
+int _fctcpy(char name); // Cosmic library: copies -ic segments to RAM
+
+// Block programming stalls reads of program memory, so this runs from RAM:
+// the FLASH_RAM section is linked with -ic (boot/boot.stp) and copied there
+// by HalFlashSetup(). It can't call anything.
+#pragma section (FLASH_RAM)
+static uint8_t ProgramBlock(uint8_t* dst, const uint8_t* data, uint8_t* rx, uint8_t rx_max)
+{
+    uint8_t got = 0;
+    uint8_t i;
+
+    FLASH_CR2 = FLASH_CR2_PRG;
+    FLASH_NCR2 = (uint8_t)~FLASH_CR2_PRG;
+    for (i = 0; i < HAL_FLASH_BLOCK; i++)
+    {
+        dst[i] = data[i];
+    }
+
+    // Over 3 ms, so a few bytes at 9600 baud: keep draining the UART.
+    while (!(FLASH_IAPSR & (FLASH_IAPSR_EOP | FLASH_IAPSR_WR_PG_DIS)))
+    {
+        if ((UART1_SR & UART1_SR_RXNE) && got < rx_max)
+        {
+            rx[got++] = UART1_DR;
+        }
+    }
+    return got;
+}
+#pragma section ()
+
+void HalFlashSetup(void)
+{
+    _fctcpy('F');
+}
+
+uint8_t HalFlashProgramBlock(uint16_t addr, const uint8_t* data, uint8_t* rx, uint8_t rx_max)
+{
+    uint8_t got;
+
+    FLASH_PUKR = FLASH_PUKR_KEY1;
+    FLASH_PUKR = FLASH_PUKR_KEY2;
+    while (!(FLASH_IAPSR & FLASH_IAPSR_PUL));
+
+    got = ProgramBlock((uint8_t*)addr, data, rx, rx_max);
+
+    FLASH_IAPSR &= ~FLASH_IAPSR_PUL; // Lock again
+    return got;
+}
@@ -0,0 +1,265 @@
+// Load benchmark. Runs the firmware, built with BENCH, through a fixed script
+// of module traffic, door travel and button presses in virtual time, then
+// prints what each bench.h probe measured as JSON on stdout.
+//
+//   garagedoor-bench [rounds [image_bytes ram_bytes]]
+//
+// Times are host nanoseconds, so compare means from the same machine; counts
+// follow from the script alone and must match exactly. The worst case of a
+// wall-clock probe is scheduler jitter, so it isn't recorded; Bench[].max is
+// for the board, in cycles. image_bytes and ram_bytes are passed through from
+// the Makefile, read off the Cosmic map, so the STM8 sizes land in the same
+// record.
+#define _POSIX_C_SOURCE 200809L
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "hal.h"
+#include "time.h"
+#include "bench.h"
+
+#define SECONDS(s) ((s) * 1000UL)
+#define ROUND_MS      SECONDS(90)
+#define DOOR_TRAVEL   SECONDS(10)
+#define WIRE_MS       1     // Per byte: 9600 baud is a little over 1 ms
+#define WIRE_MAX      1024
+
+void FirmwareMain(void); // main.c's main(), renamed by the Makefile
+
+typedef enum
+{
+    STEP_HEARTBEAT,
+    STEP_QUERY_PRODUCT,
+    STEP_QUERY_MCU,
+    STEP_QUERY_STATUS,
+    STEP_NETWORK_STATUS,
+    STEP_PAIRING_ACK,
+    STEP_CLOUD_OPEN,
+    STEP_CLOUD_CLOSE,
+    STEP_UNKNOWN_DP,
+    STEP_UNKNOWN_OPCODE,
+    STEP_BAD_CHECKSUM,
+    STEP_LONG_FRAME,
+    STEP_BUTTON_DOWN,
+    STEP_BUTTON_UP
+} E_STEP;
+
+typedef struct
+{
+    uint32_t at; // ms into the round
+    uint8_t what;
+} S_STEP;
+
+// One round. Steps are in time order.
+static const S_STEP Script[] = {
+    {     0, STEP_HEARTBEAT },
+    {   500, STEP_QUERY_PRODUCT },
+    {  1000, STEP_QUERY_MCU },
+    {  1500, STEP_QUERY_STATUS },
+    {  2000, STEP_NETWORK_STATUS },
+    {  3000, STEP_CLOUD_OPEN },
+    { 15000, STEP_HEARTBEAT },
+    { 20000, STEP_QUERY_STATUS },
+    { 25000, STEP_CLOUD_CLOSE },
+    { 30000, STEP_HEARTBEAT },
+    { 40000, STEP_BAD_CHECKSUM },
+    { 41000, STEP_LONG_FRAME },
+    { 45000, STEP_HEARTBEAT },
+    { 50000, STEP_BUTTON_DOWN },
+    { 50100, STEP_BUTTON_UP },
+    { 50200, STEP_BUTTON_DOWN },
+    { 50300, STEP_BUTTON_UP },
+    { 55000, STEP_UNKNOWN_DP },
+    { 56000, STEP_UNKNOWN_OPCODE },
+    { 57000, STEP_PAIRING_ACK },
+    { 60000, STEP_HEARTBEAT },
+    { 75000, STEP_HEARTBEAT },
+};
+#define SCRIPT_LEN (sizeof(Script) / sizeof(Script[0]))
+
+// In E_BENCH_PROBE order.
+static const char* const ProbeNames[] = {
+    "main_loop", "rx_task", "dispatch", "update_leds",
+    "isr_tick", "led_tick", "isr_uart_rx", "isr_uart_tx", "isr_sensor", "isr_button",
+    "frame_heartbeat", "frame_product_info", "frame_query_mcu", "frame_network_status",
+    "frame_reset_wifi", "frame_pairing_mode", "frame_command", "frame_status",
+    "frame_query_status", "frame_other"
+};
+typedef char ProbeNamesMatch[(sizeof(ProbeNames) / sizeof(ProbeNames[0]) == BENCH_PROBE_COUNT) ? 1 : -1];
+
+static uint32_t Rounds = 100;
+static long ImageBytes = -1;
+static long RamBytes = -1;
+
+static uint32_t Round = 0;
+static uint8_t Next = 0;
+static uint8_t Wire[WIRE_MAX]; // Module to MCU, sent a byte at a time
+static uint16_t WireHead = 0;
+static uint16_t WireTail = 0;
+static uint32_t WireNext = 0;
+
+static bool RelayWas = false;
+static uint32_t DoorPos = 0; // 0 = closed .. DOOR_TRAVEL = open
+static int8_t DoorDir = 0;
+static uint32_t DoorAt = 0;
+
+//////////////////////////////////////////////////////////////////////
+
+static void WirePut(uint8_t b)
+{
+    if (((WireHead + 1) % WIRE_MAX) == WireTail) return;
+    Wire[WireHead] = b;
+    WireHead = (WireHead + 1) % WIRE_MAX;
+}
+
+static void ModuleSend(uint8_t opcode, const uint8_t* payload, uint16_t len, bool corrupt)
+{
+    uint8_t header[6] = { 0x55, 0xAA, 0x00, opcode, len >> 8, len & 0xFF };
+    uint8_t sum = 0;
+    uint16_t i;
+
+    for (i = 0; i < sizeof(header); i++)
+    {
+        WirePut(header[i]);
+        sum += header[i];
+    }
+    for (i = 0; i < len; i++)
+    {
+        uint8_t b = payload ? payload[i] : (uint8_t)i;
+        WirePut(b);
+        sum += b;
+    }
+    WirePut(corrupt ? ~sum : sum);
+}
+
+static void ModuleCommand(uint8_t dpid, uint8_t value)
+{
+    const uint8_t dp[5] = { dpid, 0x01, 0x00, 0x01, value };
+    ModuleSend(0x06, dp, sizeof(dp), false);
+}
+
+static void RunStep(uint8_t what)
+{
+    static const uint8_t connected = 0x04;
+
+    switch (what)
+    {
+        case STEP_HEARTBEAT:      ModuleSend(0x00, 0, 0, false);          break;
+        case STEP_QUERY_PRODUCT:  ModuleSend(0x01, 0, 0, false);          break;
+        case STEP_QUERY_MCU:      ModuleSend(0x02, 0, 0, false);          break;
+        case STEP_QUERY_STATUS:   ModuleSend(0x08, 0, 0, false);          break;
+        case STEP_NETWORK_STATUS: ModuleSend(0x03, &connected, 1, false); break;
+        case STEP_PAIRING_ACK:    ModuleSend(0x05, 0, 0, false);          break;
+        case STEP_CLOUD_OPEN:     ModuleCommand(0x01, 1);                 break;
+        case STEP_CLOUD_CLOSE:    ModuleCommand(0x01, 0);                 break;
+        case STEP_UNKNOWN_DP:     ModuleCommand(0x42, 1);                 break;
+        case STEP_UNKNOWN_OPCODE: ModuleSend(0x1C, 0, 8, false);          break;
+        case STEP_BAD_CHECKSUM:   ModuleSend(0x08, 0, 0, true);           break;
+        case STEP_LONG_FRAME:     ModuleSend(0x06, 0, 300, false);        break;
+        case STEP_BUTTON_DOWN:    HalHostSetButton(true);                 break;
+        case STEP_BUTTON_UP:      HalHostSetButton(false);                break;
+    }
+}
+
+static void DoorAdvance(uint32_t now)
+{
+    uint32_t dt = now - DoorAt;
+
+    DoorAt = now;
+    if (DoorDir > 0)
+    {
+        DoorPos = (DOOR_TRAVEL - DoorPos > dt) ? DoorPos + dt : DOOR_TRAVEL;
+        if (DoorPos == DOOR_TRAVEL) DoorDir = 0;
+    }
+    else if (DoorDir < 0)
+    {
+        DoorPos = (DoorPos > dt) ? DoorPos - dt : 0;
+        if (DoorPos == 0) DoorDir = 0;
+    }
+}
+
+//////////////////////////////////////////////////////////////////////
+
+static void Report(void)
+{
+    uint8_t i;
+
+    printf("{\n  \"units\": \"ns\",\n  \"rounds\": %u,\n", Rounds);
+    if (ImageBytes >= 0) printf("  \"image_bytes\": %ld,\n  \"ram_bytes\": %ld,\n", ImageBytes, RamBytes);
+    printf("  \"probes\": {\n");
+    for (i = 0; i < BENCH_PROBE_COUNT; i++)
+    {
+        const S_BENCH* b = &Bench[i];
+        printf("    \"%s\": { \"count\": %u, \"mean\": %u, \"total\": %u }%s\n",
+               ProbeNames[i], b->count, b->count ? b->total / b->count : 0, b->total,
+               i + 1 < BENCH_PROBE_COUNT ? "," : "");
+    }
+    printf("  }\n}\n");
+}
+
+static void HarnessUartTx(uint8_t b)
+{
+    (void)b; // The script doesn't wait on answers
+}
+
+static uint32_t HarnessWake(uint32_t now)
+{
+    uint32_t round_start = Round * ROUND_MS;
+    uint32_t next;
+
+    DoorAdvance(now);
+    if (HalHostPins.relay && !RelayWas && !DoorDir)
+    {
+        DoorDir = DoorPos ? -1 : 1;
+    }
+    RelayWas = HalHostPins.relay;
+
+    while (Next < SCRIPT_LEN && round_start + Script[Next].at <= now)
+    {
+        RunStep(Script[Next++].what);
+    }
+    if (Next == SCRIPT_LEN && now >= round_start + ROUND_MS - 1)
+    {
+        if (++Round == Rounds)
+        {
+            Report();
+            exit(0);
+        }
+        Next = 0;
+        round_start += ROUND_MS;
+    }
+    next = (Next < SCRIPT_LEN) ? round_start + Script[Next].at : round_start + ROUND_MS;
+
+    if (WireTail != WireHead && now >= WireNext)
+    {
+        HalHostUartInject(&Wire[WireTail], 1);
+        WireTail = (WireTail + 1) % WIRE_MAX;
+        WireNext = now + WIRE_MS;
+    }
+    if (WireTail != WireHead && WireNext < next) next = WireNext;
+
+    HalHostSetSensor(DoorPos > 0);
+    if (DoorDir > 0 && now + DOOR_TRAVEL - DoorPos < next) next = now + DOOR_TRAVEL - DoorPos;
+    if (DoorDir < 0 && now + DoorPos < next) next = now + DoorPos;
+
+    return next;
+}
+
+static const S_HAL_HOST_HARNESS BenchHarness = { HarnessUartTx, HarnessWake };
+
+int main(int argc, char** argv)
+{
+    if (argc > 1) Rounds = strtoul(argv[1], 0, 0);
+    if (argc > 3)
+    {
+        ImageBytes = strtol(argv[2], 0, 0);
+        RamBytes = strtol(argv[3], 0, 0);
+    }
+    if (!Rounds) Rounds = 1;
+
+    HalHostAttach(&BenchHarness);
+    FirmwareMain();
+    return 3; // Never returns
+}
@@ -0,0 +1,517 @@
+#define _POSIX_C_SOURCE 200809L
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <time.h>
+#include "hal.h"
+#include "time.h"
+#include "tuya.h"
+#include "sensor.h"
+#include "button.h"
+#include "led.h"
+#include "bench.h"
+#include "latency.h"
+#include "trace.h"
+
+// Without a harness, the UART is the process's stdin/stdout, or the file or
+// pty named by GARAGEDOOR_UART, and end of input ends the run.
+#define UART_ENV "GARAGEDOOR_UART"
+#define TRACE_ENV "GARAGEDOOR_TRACE" // File the trace block is written to at exit, for tracedump.py
+#define EEPROM_ENV "GARAGEDOOR_EEPROM" // File that keeps the data EEPROM from one run to the next
+#define INJECT_MAX 512 // An upgrade package frame with room to spare
+
+// A block write stalls the core for this long, and about this many bytes
+// arrive at 9600 baud meanwhile.
+#define FLASH_BLOCK_MS 3
+#define FLASH_BLOCK_SPILL 3
+#define EEPROM_WORD_MS 6 // Erase and write
+
+enum
+{
+    IRQ_EXTI_PORTC = 1 << 0,
+    IRQ_EXTI_PORTD = 1 << 1
+};
+
+S_HAL_HOST_PINS HalHostPins;
+uint8_t HalHostFlash[HAL_HOST_FLASH_SIZE];
+uint8_t HalHostEeprom[HAL_HOST_EEPROM_SIZE];
+const char HalHostProductKey[] = "hostbuildhostbld";
+
+static bool Masked = true; // As out of reset
+static bool InIsr = false;
+static uint8_t Pending = 0; // IRQ_* raised while masked
+
+static int UartIn = STDIN_FILENO;
+static int UartOut = STDOUT_FILENO;
+static bool UartEnabled = false;
+static bool UartTxIrq = false;
+static uint8_t UartRx;
+
+static bool TickEnabled = false;
+static uint64_t TickNextNs;
+
+static bool SensorIrq = false;
+static bool ButtonIrq = false;
+
+static const S_HAL_HOST_HARNESS* Harness = 0;
+static uint8_t Inject[INJECT_MAX]; // Bytes from the harness, not yet received
+static uint16_t InjectLen = 0;
+static uint16_t InjectAt = 0;      // Next one for HalUartPoll()
+
+static bool EepromWriting = false;
+static uint32_t EepromWriteAt;     // get_milliseconds_now() when the word write started
+static uint8_t EepromWriteOffset;
+
+static uint64_t NowNs(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + ts.tv_nsec;
+}
+
+// The vectors, paired up as in stm8_interrupt_vector.c.
+static void Irq5(void)
+{
+    HAL_CYCLES_T start = HalCycles();
+
+    BENCH_BEGIN(BENCH_ISR_SENSOR);
+    ISR_EXTI_PORTC();
+    BENCH_END(BENCH_ISR_SENSOR);
+    LatencyIsrDone(LATENCY_ISR_SENSOR, start);
+}
+
+static void Irq6(void)
+{
+    HAL_CYCLES_T start = HalCycles();
+
+    BENCH_BEGIN(BENCH_ISR_BUTTON);
+    ISR_EXTI_PORTD();
+    BENCH_END(BENCH_ISR_BUTTON);
+    LatencyIsrDone(LATENCY_ISR_BUTTON, start);
+}
+
+static void Irq17(void)
+{
+    HAL_CYCLES_T start = HalCycles();
+
+    BENCH_BEGIN(BENCH_ISR_UART_TX);
+    ISR_UART1_TX();
+    BENCH_END(BENCH_ISR_UART_TX);
+    LatencyIsrDone(LATENCY_ISR_UART_TX, start);
+}
+
+static void Irq18(void)
+{
+    HAL_CYCLES_T start = HalCycles();
+
+    BENCH_BEGIN(BENCH_ISR_UART_RX);
+    ISR_UART1_RX();
+    BENCH_END(BENCH_ISR_UART_RX);
+    LatencyIsrDone(LATENCY_ISR_UART_RX, start);
+}
+
+static void Irq23(void)
+{
+    HAL_CYCLES_T start = HalCycles();
+
+    BENCH_BEGIN(BENCH_ISR_TICK);
+    ISR_TIM4_UPDATE();
+    BENCH_END(BENCH_ISR_TICK);
+    BENCH_BEGIN(BENCH_LED_TICK);
+    LedTick();
+    BENCH_END(BENCH_LED_TICK);
+    LatencyIsrDone(LATENCY_ISR_TICK, start);
+}
+
+static void ServiceVirtual(bool block)
+{
+    uint32_t now;
+    uint32_t wake;
+    uint32_t idle;
+    uint16_t i;
+
+    if (block)
+    {
+        // Nothing happens in between, so go straight to whichever comes first:
+        // the harness's next action or the nearest timer deadline.
+        now = get_milliseconds_now();
+        wake = Harness->wake(now);
+        if (!Pending && !InjectLen && TickEnabled)
+        {
+            idle = TimerIdleFor();
+            if (wake - now < idle) idle = wake - now;
+            if (idle > 1) TimeSkip(idle - 1);
+            Irq23();
+        }
+    }
+
+    if (Pending & IRQ_EXTI_PORTC)
+    {
+        Pending &= ~IRQ_EXTI_PORTC;
+        Irq5();
+    }
+    if (Pending & IRQ_EXTI_PORTD)
+    {
+        Pending &= ~IRQ_EXTI_PORTD;
+        Irq6();
+    }
+    for (i = 0; i < InjectLen; i++)
+    {
+        UartRx = Inject[i];
+        Irq18();
+    }
+    InjectLen = 0;
+    while (UartTxIrq)
+    {
+        Irq17();
+    }
+}
+
+static void Service(bool block)
+{
+    struct pollfd pfd;
+    uint64_t now;
+    int timeout = 0;
+    uint8_t buf[64];
+    ssize_t n;
+    ssize_t i;
+
+    if (Masked || InIsr) return;
+    InIsr = true;
+
+    if (Harness)
+    {
+        ServiceVirtual(block);
+        InIsr = false;
+        return;
+    }
+
+    if (Pending & IRQ_EXTI_PORTC)
+    {
+        Pending &= ~IRQ_EXTI_PORTC;
+        Irq5();
+    }
+    if (Pending & IRQ_EXTI_PORTD)
+    {
+        Pending &= ~IRQ_EXTI_PORTD;
+        Irq6();
+    }
+    while (UartTxIrq)
+    {
+        Irq17(); // The host side takes every byte at once
+    }
+
+    now = NowNs();
+    if (TickEnabled)
+    {
+        while (now >= TickNextNs)
+        {
+            Irq23();
+            TickNextNs += 1000000;
+        }
+        if (block) timeout = (int)((TickNextNs - now + 999999) / 1000000);
+    }
+    else if (block)
+    {
+        timeout = -1;
+    }
+
+    if (UartEnabled)
+    {
+        pfd.fd = UartIn;
+        pfd.events = POLLIN;
+        if (poll(&pfd, 1, timeout) > 0)
+        {
+            n = read(UartIn, buf, sizeof(buf));
+            if (n <= 0) exit(0);
+            for (i = 0; i < n; i++)
+            {
+                UartRx = buf[i];
+                Irq18();
+            }
+        }
+    }
+
+    InIsr = false;
+}
+
+void HalHostIrqEnable(void)
+{
+    Masked = false;
+    Service(false);
+}
+
+void HalHostIrqDisable(void)
+{
+    Masked = true;
+}
+
+void HalHostWait(void)
+{
+    Masked = false;
+    Service(true);
+}
+
+uint8_t HalHostUartRead(void)
+{
+    return UartRx;
+}
+
+void HalHostUartWrite(uint8_t b)
+{
+    if (Harness)
+    {
+        Harness->uart_tx(b);
+        return;
+    }
+    if (write(UartOut, &b, 1) != 1) exit(1);
+}
+
+void HalHostUartTxIrq(bool on)
+{
+    UartTxIrq = on;
+}
+
+void HalHostSetSensor(bool open)
+{
+    if (open == HalHostPins.sensor_open) return;
+    HalHostPins.sensor_open = open;
+    if (SensorIrq) Pending |= IRQ_EXTI_PORTC;
+    Service(false);
+}
+
+void HalHostSetButton(bool down)
+{
+    if (down == HalHostPins.button_down) return;
+    HalHostPins.button_down = down;
+    if (ButtonIrq) Pending |= IRQ_EXTI_PORTD;
+    Service(false);
+}
+
+void HalHostAttach(const S_HAL_HOST_HARNESS* harness)
+{
+    Harness = harness;
+}
+
+void HalHostUartInject(const uint8_t* bytes, uint16_t len)
+{
+    // Arrives all at once: the harness paces frames, not bytes.
+    if (InjectAt)
+    {
+        memmove(Inject, Inject + InjectAt, InjectLen - InjectAt);
+        InjectLen -= InjectAt;
+        InjectAt = 0;
+    }
+    while (len-- && InjectLen < INJECT_MAX)
+    {
+        Inject[InjectLen++] = *bytes++;
+    }
+}
+
+#ifdef TRACE
+static void DumpTrace(void)
+{
+    int fd = open(getenv(TRACE_ENV), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+
+    if (fd < 0) return;
+    if (write(fd, &Trace, sizeof(Trace)) != sizeof(Trace)) perror(TRACE_ENV);
+    close(fd);
+}
+#endif
+
+static void LoadEeprom(void)
+{
+    int fd = open(getenv(EEPROM_ENV), O_RDONLY);
+
+    if (fd < 0) return; // Blank, as from the factory
+    if (read(fd, HalHostEeprom, sizeof(HalHostEeprom)) < 0) perror(EEPROM_ENV);
+    close(fd);
+}
+
+static void SaveEeprom(void)
+{
+    int fd = open(getenv(EEPROM_ENV), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+
+    if (fd < 0) return;
+    if (write(fd, HalHostEeprom, sizeof(HalHostEeprom)) != sizeof(HalHostEeprom)) perror(EEPROM_ENV);
+    close(fd);
+}
+
+void HalGpioSetup(void)
+{
+#ifdef TRACE
+    if (getenv(TRACE_ENV)) atexit(DumpTrace);
+#endif
+    if (getenv(EEPROM_ENV)) LoadEeprom();
+    LED_OFF();
+    RELAY_OPEN();
+}
+
+void HalUartSetup(uint16_t baud)
+{
+    const char* path = getenv(UART_ENV);
+
+    (void)baud;
+    if (path && !Harness)
+    {
+        UartIn = UartOut = open(path, O_RDWR | O_NOCTTY);
+        if (UartIn < 0) exit(1);
+    }
+    UartEnabled = true;
+}
+
+void HalTickSetup(void)
+{
+    TickNextNs = NowNs() + 1000000;
+    TickEnabled = true;
+}
+
+void HalSensorIrqSetup(void)
+{
+    SensorIrq = true;
+}
+
+void HalButtonIrqSetup(void)
+{
+    ButtonIrq = true;
+}
+
+void HalCyclesSetup(void)
+{
+}
+
+HAL_CYCLES_T HalCycles(void)
+{
+    return (HAL_CYCLES_T)NowNs();
+}
+
+void HalFlashSetup(void)
+{
+}
+
+uint8_t HalFlashProgramBlock(uint16_t addr, const uint8_t* data, uint8_t* rx, uint8_t rx_max)
+{
+    uint8_t got = 0;
+
+    if (addr % HAL_FLASH_BLOCK || addr < HAL_HOST_FLASH_BASE ||
+        addr - HAL_HOST_FLASH_BASE > HAL_HOST_FLASH_SIZE - HAL_FLASH_BLOCK)
+    {
+        fprintf(stderr, "flash block write at 0x%04X\n", addr);
+        exit(5);
+    }
+    memcpy(&HalHostFlash[addr - HAL_HOST_FLASH_BASE], data, HAL_FLASH_BLOCK);
+
+    if (Harness) TimeSkip(FLASH_BLOCK_MS);
+    while (got < rx_max && got < FLASH_BLOCK_SPILL && InjectAt < InjectLen)
+    {
+        rx[got++] = Inject[InjectAt++];
+    }
+    return got;
+}
+
+void HalEepromWrite(uint8_t offset, const uint8_t* data, uint8_t len)
+{
+    if (offset + len > HAL_HOST_EEPROM_SIZE)
+    {
+        fprintf(stderr, "EEPROM write at %u\n", offset);
+        exit(5);
+    }
+    memcpy(&HalHostEeprom[offset], data, len);
+    if (getenv(EEPROM_ENV)) SaveEeprom(); // Written through, so a kill loses nothing
+}
+
+void HalEepromWriteWord(uint8_t offset, const uint8_t* data)
+{
+    if (offset % HAL_EEPROM_WORD)
+    {
+        fprintf(stderr, "EEPROM word write at %u\n", offset);
+        exit(5);
+    }
+    if (HalEepromBusy())
+    {
+        fprintf(stderr, "EEPROM word write at %u while busy\n", offset);
+        exit(5);
+    }
+    HalEepromWrite(offset, data, HAL_EEPROM_WORD);
+    EepromWriting = true;
+    EepromWriteAt = get_milliseconds_now();
+    EepromWriteOffset = offset;
+}
+
+bool HalEepromBusy(void)
+{
+    if (EepromWriting && get_milliseconds_since(EepromWriteAt) < EEPROM_WORD_MS) return true;
+    EepromWriting = false;
+    return false;
+}
+
+int HalHostEepromCut(uint8_t written)
+{
+    if (!HalEepromBusy()) return -1;
+    // The bytes went in whole when the write started; take back the unwritten.
+    memset(&HalHostEeprom[EepromWriteOffset + written], 0, HAL_EEPROM_WORD - written);
+    if (getenv(EEPROM_ENV)) SaveEeprom();
+    EepromWriting = false;
+    return EepromWriteOffset;
+}
+
+bool HalUartPoll(uint8_t* b)
+{
+    struct pollfd pfd;
+    uint32_t now;
+    uint32_t wake;
+
+    if (!Harness)
+    {
+        pfd.fd = UartIn;
+        pfd.events = POLLIN;
+        if (poll(&pfd, 1, 0) <= 0) return false;
+        if (read(UartIn, b, 1) != 1) exit(0);
+        return true;
+    }
+
+    if (InjectAt == InjectLen)
+    {
+        // Nothing else runs while the loader polls, so the clock can jump
+        // straight to the harness's next action.
+        InjectAt = InjectLen = 0;
+        now = get_milliseconds_now();
+        wake = Harness->wake(now);
+        if (!InjectLen) TimeSkip(wake > now ? wake - now : 1);
+        return false;
+    }
+    *b = Inject[InjectAt++];
+    return true;
+}
+
+void HalUartPut(uint8_t b)
+{
+    HalHostUartWrite(b);
+}
+
+void HalReset(void)
+{
+    // Peripherals back to how they come out of reset; RAM stays as it was.
+    Masked = true;
+    InIsr = false;
+    Pending = 0;
+    InjectLen = InjectAt = 0;
+    UartEnabled = false;
+    UartTxIrq = false;
+    TickEnabled = false;
+    SensorIrq = false;
+    ButtonIrq = false;
+    if (Harness && Harness->reset) Harness->reset();
+    exit(0);
+}
+
+void HalJumpToApp(void)
+{
+    if (Harness && Harness->start_app) Harness->start_app();
+    exit(0);
+}
@@ -0,0 +1,94 @@
+#pragma once
+#include <stdint.h>
+#include <stdbool.h>
+
+// Host backend of the HAL. The board is a set of plain variables, and
+// interrupts are delivered by HalHostService() whenever the firmware unmasks
+// them or waits for one, which is where they could land on the real part too.
+// Everything runs on one thread.
+
+typedef struct
+{
+    bool red_led;     // true = lit
+    bool blue_led;
+    bool relay;       // true = closed (motor switch pressed)
+    bool sensor_open; // Door sensor level
+    bool button_down;
+} S_HAL_HOST_PINS;
+
+extern S_HAL_HOST_PINS HalHostPins;
+
+void HalHostIrqEnable(void);
+void HalHostIrqDisable(void);
+void HalHostWait(void);
+uint8_t HalHostUartRead(void);
+void HalHostUartWrite(uint8_t b);
+void HalHostUartTxIrq(bool on);
+
+// Stimulus, for harnesses driving the firmware. Edges raise the matching
+// external interrupt.
+void HalHostSetSensor(bool open);
+void HalHostSetButton(bool down);
+
+// A harness that replaces the wall clock and the UART. Once attached, time is
+// virtual: whenever the firmware waits for an interrupt, the harness is asked
+// when it next needs to act, and the clock jumps straight to that or to the
+// next timer deadline, whichever is sooner.
+typedef struct
+{
+    void (*uart_tx)(uint8_t b);     // A byte the firmware sent
+    uint32_t (*wake)(uint32_t now); // The CPU is idle at 'now'. Apply what's due;
+                                    // return when to be called next.
+    void (*reset)(void);            // HalReset(); must not return
+    void (*start_app)(void);        // HalJumpToApp(); must not return
+} S_HAL_HOST_HARNESS;
+
+void HalHostAttach(const S_HAL_HOST_HARNESS* harness);
+void HalHostUartInject(const uint8_t* bytes, uint16_t len);
+
+#define INTERRUPT_EN()        HalHostIrqEnable()
+#define INTERRUPT_DIS()       HalHostIrqDisable()
+#define WAIT_FOR_INTERRUPT()  HalHostWait()
+
+#define BLUE_LED_ON()   (HalHostPins.blue_led = true)
+#define BLUE_LED_OFF()  (HalHostPins.blue_led = false)
+#define RED_LED_ON()    (HalHostPins.red_led = true)
+#define RED_LED_OFF()   (HalHostPins.red_led = false)
+#define LED_OFF()       (HalHostPins.red_led = HalHostPins.blue_led = false)
+#define RELAY_CLOSE()   (HalHostPins.relay = true)
+#define RELAY_OPEN()    (HalHostPins.relay = false)
+
+#define GET_SENSOR_BOOL()  (HalHostPins.sensor_open)
+#define GET_BUTTON()       (!HalHostPins.button_down) // Active low, like the pin
+
+#define HAL_UART_STATUS()      0
+#define HAL_UART_OVERRUN       0x08
+#define HAL_UART_FRAMING       0x02
+#define HAL_UART_READ()        HalHostUartRead()
+#define HAL_UART_WRITE(b)      HalHostUartWrite(b)
+#define HAL_UART_TX_IRQ_ON()   HalHostUartTxIrq(true)
+#define HAL_UART_TX_IRQ_OFF()  HalHostUartTxIrq(false)
+
+#define HAL_TICK_ACK()         ((void)0)
+
+#define HAL_NEAR
+
+typedef uint32_t HAL_CYCLES_T; // Nanoseconds of the host's clock
+#define HAL_CYCLES_MAX 0xFFFFFFFFUL
+
+// Program memory and data EEPROM, as on the part. Blank flash reads 0x00.
+#define HAL_HOST_FLASH_BASE 0x8000
+#define HAL_HOST_FLASH_SIZE 0x2000
+#define HAL_HOST_EEPROM_SIZE 128
+extern uint8_t HalHostFlash[HAL_HOST_FLASH_SIZE];
+extern uint8_t HalHostEeprom[HAL_HOST_EEPROM_SIZE];
+#define HAL_FLASH(addr)    ((const uint8_t*)&HalHostFlash[(addr) - HAL_HOST_FLASH_BASE])
+#define HAL_EEPROM(offset) ((const uint8_t*)&HalHostEeprom[offset])
+
+// Power cut, for harnesses: a word write still in progress is left half done,
+// its first 'written' bytes programmed and the rest erased. Returns the word's
+// offset, or -1 if none was in progress.
+int HalHostEepromCut(uint8_t written);
+
+extern const char HalHostProductKey[];
+#define HAL_PRODUCT_KEY  HalHostProductKey
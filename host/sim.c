@@ -0,0 +1,1279 @@
+// Door controller simulator. Runs the firmware against a virtual clock, a
+// modelled door and a scripted Wi-Fi module, one forked process per scenario
+// so each one boots from a clean image.
+//
+//   garagedoor-sim [count [first_seed]]   Sweep random scenarios
+//   garagedoor-sim -s seed                Run one scenario, with a trace
+//   garagedoor-sim -u [count | -s seed]   Firmware updates instead: good images,
+//                                         lost packages and bad CRCs
+//   garagedoor-sim -p [count | -s seed]   Settings and the event log across a
+//                                         power cut, mid-save ones included
+//
+// Exits non-zero if any scenario broke an invariant.
+#define _POSIX_C_SOURCE 200809L
+#define _DEFAULT_SOURCE // MAP_ANONYMOUS
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <sys/mman.h>
+#include <setjmp.h>
+#include <time.h>
+#include "hal.h"
+#include "time.h"
+#include "ota.h"
+#include "config.h"
+#include "eventlog.h"
+
+#define NEVER 0xFFFFFFFFUL
+#define SECONDS(s) ((s) * 1000UL)
+
+// What the firmware is expected to do, from the outside.
+#define RELAY_PULSE_MAX     1500         // Longest the motor switch may be held
+#define HEARTBEAT_PERIOD    SECONDS(15)  // As the real module does
+#define SETTLE_TIME         SECONDS(400) // Auto-close plus three close attempts, with room to spare
+#define NOMINAL_TRAVEL_MAX  SECONDS(19)  // Slower doors can legitimately end in a close error
+
+#define ACTIONS_MAX 12
+
+// Module outages
+#define NET_STATUS_ROUTER_ONLY 0x03 // On the router, but the cloud can't be reached
+#define NET_STATUS_CLOUD       0x04
+
+// Firmware update runs
+#define OTA_START_AT        SECONDS(5)   // After the handshake
+#define OTA_RETRY_TIME      SECONDS(1)   // Module resends an unacknowledged package
+#define OTA_TIME_MAX        SECONDS(120)
+
+// Settings and event log runs
+#define EEPROM_ENV          "GARAGEDOOR_EEPROM" // hal_host.c keeps the data EEPROM in it
+#define PERSIST_OPS_AT      SECONDS(3)   // After the handshake
+#define PERSIST_CONFIRM_MAX SECONDS(2)   // A write or a button press is reported back by then
+#define PERSIST_TRAVEL      SECONDS(10)
+#define PERSIST_CUT_MID_MAX 60           // ms after a write: before, during and after its save
+#define PERSIST_TIME_MAX    SECONDS(86400) // A day
+#define PERSIST_CHANGES_MAX 64
+#define PERSIST_RECORDS_MAX (PERSIST_CHANGES_MAX + 1)
+
+void FirmwareMain(void); // main.c's main(), renamed by the Makefile
+void BootMain(void);     // boot/boot.c's
+
+typedef enum
+{
+    RUN_DOOR,   // The door, the button and the cloud
+    RUN_OTA,    // Firmware updates
+    RUN_PERSIST // Power cuts
+} E_RUN;
+
+typedef enum
+{
+    ACT_WALL_PRESS,  // Someone uses the wall switch of the opener
+    ACT_CLOUD_OPEN,
+    ACT_CLOUD_CLOSE,
+    ACT_BUTTON_DOWN, // The button on the unit
+    ACT_BUTTON_UP,
+    ACT_WIFI_DOWN,   // The module loses the cloud, and says so
+    ACT_WIFI_UP,
+    ACT_MODULE_REBOOT // The module goes silent for a while, then starts over
+} E_ACTION;
+
+static const char* const ActionNames[] = {
+    "wall press", "cloud open", "cloud close", "button down", "button up",
+    "wifi down", "wifi up", "module reboot"
+};
+
+typedef struct
+{
+    uint32_t at;
+    uint8_t what;
+    uint32_t arg; // ACT_MODULE_REBOOT: how long it's out
+} S_ACTION;
+
+// The opener: one switch that starts, stops and reverses the motor, and a
+// reed switch that only reads closed when the door is all the way down.
+typedef struct
+{
+    uint32_t travel;    // ms from closed to open
+    uint32_t pos;       // 0 = closed .. travel = open
+    int8_t dir;         // +1 opening, -1 closing, 0 stopped
+    int8_t last_dir;
+    uint32_t at;        // Time pos was last brought up to date
+    // Faults
+    int8_t stuck;       // Sensor stuck at this level, or -1
+    uint32_t obstruct;  // Closing reverses when pos gets down to this, or 0
+    uint8_t missed;     // Relay presses the opener will still ignore
+} S_DOOR;
+
+typedef struct
+{
+    uint32_t seed;
+    uint32_t end;
+    S_ACTION actions[ACTIONS_MAX];
+    uint8_t action_count;
+    bool cloud_open_used;
+    bool interfered; // The wall switch and the relay crossed, so the door may end up anywhere
+    S_DOOR door;
+} S_SCENARIO;
+
+static S_SCENARIO Sc;
+static bool Verbose = false;
+
+// Harness state, in the forked child only.
+static uint8_t NextAction = 0;
+static uint32_t NextHeartbeat = 50;
+static bool RelayWas = false;
+static uint32_t PulseStart = 0;
+static uint16_t Presses = 0;
+static uint32_t WallPressAt = NEVER;
+static int8_t Reported = -1; // Door datapoint as last reported, or -1
+static bool LinkUp = false;
+static bool CloudUp = true;
+static uint32_t ModuleBackAt = 0; // Rebooting until then
+static uint16_t LostReports = 0;  // Status frames that never reached the cloud
+static uint8_t TxFrame[300];
+static uint16_t TxLen = 0;
+static bool CorruptNext = false; // Next frame to the firmware goes with a bad checksum
+
+typedef enum
+{
+    OTA_GOOD,
+    OTA_LOST_PACKAGE, // One package arrives corrupted and has to be resent
+    OTA_BAD_CRC,      // The image doesn't match its CRC, so must never start
+    OTA_VARIANTS
+} E_OTA_VARIANT;
+
+static const char* const OtaVariantNames[] = { "good image", "lost package", "bad CRC" };
+
+typedef struct
+{
+    uint8_t variant;
+    uint8_t image[OTA_IMAGE_MAX];
+    uint16_t size;
+    uint8_t corrupt;     // Package sent corrupted once, for OTA_LOST_PACKAGE
+    bool started;        // 0x0A sent
+    bool in_boot;
+    uint16_t acked;      // Image bytes acknowledged
+    uint16_t package;    // Bytes in the package outstanding
+    uint32_t sent_at;    // When it went out, or NEVER if there's none
+    uint16_t packages;   // Packages sent, resends included
+    bool ended;          // Empty package acknowledged
+} S_OTA_RUN;
+
+static S_OTA_RUN Ota;
+static jmp_buf OtaBoot;
+
+typedef enum
+{
+    PERSIST_SETTLED,  // Power cut well after the last change was saved
+    PERSIST_MID_SAVE, // Cut within moments of the last write, maybe mid-save
+    PERSIST_BIT_ROT,  // Settled, then the newer config copy goes bad while off
+    PERSIST_VARIANTS
+} E_PERSIST_VARIANT;
+
+static const char* const PersistVariantNames[] = { "settled", "mid-save", "bit rot" };
+
+typedef enum
+{
+    OP_LOCKDOWN,   // Cloud write of the other lockdown setting
+    OP_BUTTON,     // Short press on the unit: the same
+    OP_RESEND,     // Cloud write of what's already set, saved and logged never
+    OP_AUTO_CLOSE, // Cloud write of a new auto-close time
+    OP_TRAVEL,     // Likewise the travel time
+    OPS
+} E_PERSIST_OP;
+
+typedef struct
+{
+    uint8_t lockdown;
+    uint8_t travel_s;
+    uint16_t auto_close_s;
+} S_SETTINGS;
+
+typedef struct
+{
+    uint8_t type;
+    uint8_t arg;
+    uint32_t at; // When it was reported back
+} S_PERSIST_RECORD;
+
+// Shared by the two boots of a run: the first one fills it in as it goes,
+// the second checks against it.
+typedef struct
+{
+    uint8_t variant;
+    S_SETTINGS settings;           // As last reported back
+    S_SETTINGS previous;           // Before the last change
+    S_SETTINGS before;             // Before the last write, and what it asked for
+    S_SETTINGS after;
+    uint8_t changes;
+    S_PERSIST_RECORD records[PERSIST_RECORDS_MAX]; // Expected in the log, oldest first
+    uint8_t record_count;
+    uint8_t settled_records;       // Of them, before the last write
+    bool pending_record;           // The last write is a lockdown change the cut may have beaten
+    int torn;                      // EEPROM word the cut left half written, or -1
+    // The second boot
+    bool lockdown_seen;
+    uint8_t lockdown;
+    uint32_t open_at;              // Door reported open, then the auto-close press
+    uint32_t close_at;
+    uint32_t closed_at;            // Door reported closed again
+    S_EVENTLOG_PAGE pages[EVENTLOG_PAGES];
+    uint8_t pages_in;
+} S_PERSIST_RUN;
+
+static S_PERSIST_RUN* Persist = 0; // Set in -p runs only
+static uint8_t PersistBoot;
+static uint8_t PersistOps;
+static uint32_t OpAt = 0;          // Next op
+static uint8_t OpsDone = 0;
+static uint8_t AwaitDp = 0;        // Datapoint the op in progress is reported back in
+static uint32_t AwaitUntil = 0;
+static bool ButtonHeld = false;
+static uint32_t CutAt = NEVER;
+static uint32_t PageAt = NEVER;    // When to ask for the next log page
+
+static void PersistReported(uint32_t now, uint8_t dp, const uint8_t* data, uint16_t len);
+
+//////////////////////////////////////////////////////////////////////
+
+static uint32_t Rand(void)
+{
+    // xorshift32, so a seed means the same scenario everywhere.
+    static uint32_t x;
+    if (!x) x = Sc.seed * 2654435761u + 1;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    return x;
+}
+
+static uint32_t RandRange(uint32_t lo, uint32_t hi)
+{
+    return lo + Rand() % (hi - lo + 1);
+}
+
+static void Trace(uint32_t now, const char* what, long arg)
+{
+    if (Verbose) printf("%9.3f  %-22s %ld\n", now / 1000.0, what, arg);
+}
+
+static void Fail(uint32_t now, const char* why)
+{
+    printf("seed %u: t=%.3f s: %s\n", Sc.seed, now / 1000.0, why);
+    fflush(stdout);
+    exit(1);
+}
+
+//////////////////////////////////////////////////////////////////////
+// Door model
+
+static bool DoorSensor(void)
+{
+    if (Sc.door.stuck >= 0) return Sc.door.stuck;
+    return Sc.door.pos > 0;
+}
+
+static void DoorAdvance(uint32_t now)
+{
+    S_DOOR* d = &Sc.door;
+    uint32_t dt = now - d->at;
+
+    d->at = now;
+    if (d->dir > 0)
+    {
+        d->pos = (d->travel - d->pos > dt) ? d->pos + dt : d->travel;
+        if (d->pos == d->travel)
+        {
+            d->last_dir = d->dir;
+            d->dir = 0;
+        }
+    }
+    else if (d->dir < 0)
+    {
+        uint32_t floor = d->obstruct;
+        d->pos = (d->pos - floor > dt) ? d->pos - dt : floor;
+        if (d->pos == floor)
+        {
+            d->last_dir = d->dir;
+            d->dir = floor ? 1 : 0; // An obstruction sends it back up
+            Trace(now, floor ? "door obstructed" : "door closed", d->pos);
+        }
+    }
+}
+
+static uint32_t DoorNext(uint32_t now)
+{
+    S_DOOR* d = &Sc.door;
+    if (d->dir > 0) return now + (d->travel - d->pos);
+    if (d->dir < 0) return now + (d->pos - d->obstruct);
+    return NEVER;
+}
+
+static void DoorPress(uint32_t now)
+{
+    S_DOOR* d = &Sc.door;
+
+    if (d->missed)
+    {
+        d->missed--;
+        Trace(now, "press missed", d->missed);
+        return;
+    }
+    if (d->dir)
+    {
+        d->last_dir = d->dir;
+        d->dir = 0;
+    }
+    else if (d->pos == 0)
+    {
+        d->dir = 1;
+    }
+    else if (d->pos == d->travel)
+    {
+        d->dir = -1;
+    }
+    else
+    {
+        d->dir = -d->last_dir;
+    }
+    Trace(now, "door moves", d->dir);
+}
+
+//////////////////////////////////////////////////////////////////////
+// Wi-Fi module model
+
+static void ModuleSend(uint8_t opcode, const uint8_t* payload, uint16_t len)
+{
+    uint8_t frame[7 + 4 + OTA_PACKAGE_SIZE];
+    uint8_t sum = 0;
+    uint16_t i;
+
+    frame[0] = 0x55;
+    frame[1] = 0xAA;
+    frame[2] = 0x00;
+    frame[3] = opcode;
+    frame[4] = len >> 8;
+    frame[5] = len & 0xFF;
+    memcpy(frame + 6, payload, len);
+    for (i = 0; i < 6 + len; i++) sum += frame[i];
+    frame[6 + len] = CorruptNext ? ~sum : sum;
+    CorruptNext = false;
+    HalHostUartInject(frame, 7 + len);
+}
+
+static void ModuleSendPackage(uint32_t now)
+{
+    uint8_t payload[4 + OTA_PACKAGE_SIZE];
+    uint16_t len = Ota.size - Ota.acked;
+
+    if (len > OTA_PACKAGE_SIZE) len = OTA_PACKAGE_SIZE;
+    payload[0] = 0;
+    payload[1] = 0;
+    payload[2] = Ota.acked >> 8;
+    payload[3] = Ota.acked & 0xFF;
+    memcpy(payload + 4, Ota.image + Ota.acked, len);
+    if (Ota.variant == OTA_LOST_PACKAGE && Ota.packages == Ota.corrupt) CorruptNext = true;
+    ModuleSend(0x0B, payload, 4 + len);
+    Ota.package = len;
+    Ota.sent_at = now;
+    Ota.packages++;
+    Trace(now, len ? "package" : "end of image", Ota.acked);
+}
+
+static void ModuleWriteDp(uint8_t id, uint8_t type, uint32_t value)
+{
+    uint8_t dp[8] = { id, type, 0x00, 0x01, (uint8_t)value };
+
+    if (type == 0x02) // Value: four bytes, big-endian
+    {
+        dp[3] = 4;
+        dp[4] = value >> 24;
+        dp[5] = value >> 16;
+        dp[6] = value >> 8;
+        dp[7] = value;
+    }
+    ModuleSend(0x06, dp, 4 + dp[3]);
+}
+
+static void ModuleCommandDoor(bool open)
+{
+    ModuleWriteDp(0x01, 0x01, open);
+}
+
+static void ModuleReceived(uint32_t now, const uint8_t* f, uint16_t len)
+{
+    uint16_t pos = 6;
+
+    if (now < ModuleBackAt) return; // Nobody listening
+    if (f[3] == 0x07 && !CloudUp)
+    {
+        LostReports++;
+        Trace(now, "report lost offline", LostReports);
+        return;
+    }
+
+    switch (f[3])
+    {
+        // After it boots, the module walks through these one answer at a time.
+        case 0x00: // Heartbeat
+            if (!LinkUp)
+            {
+                LinkUp = true;
+                ModuleSend(0x01, 0, 0); // Product info
+            }
+            break;
+
+        case 0x01:
+            ModuleSend(0x02, 0, 0); // MCU working mode
+            break;
+
+        case 0x02:
+            ModuleSend(0x08, 0, 0); // Query status
+            break;
+
+        case 0x07: // Status: look for the door datapoint
+            while (pos + 4 <= len)
+            {
+                uint16_t dp_len = (f[pos + 2] << 8) | f[pos + 3];
+                if (f[pos] == 0x01 && dp_len == 1)
+                {
+                    Reported = f[pos + 4];
+                    Trace(now, "reported door", Reported);
+                }
+                if (Persist) PersistReported(now, f[pos], f + pos + 4, dp_len);
+                pos += 4 + dp_len;
+            }
+            break;
+
+        case 0x0A: // Upgrade start: package size code
+            if (len != 7 || f[6] != OTA_PACKAGE_CODE) Fail(now, "bad upgrade start reply");
+            Trace(now, "upgrade accepted", Ota.size);
+            ModuleSendPackage(now);
+            break;
+
+        case 0x0B: // Package acknowledged
+            if (Ota.sent_at == NEVER) Fail(now, "package acknowledged twice");
+            Ota.sent_at = NEVER;
+            if (!Ota.package)
+            {
+                Ota.ended = true;
+                break;
+            }
+            Ota.acked += Ota.package;
+            ModuleSendPackage(now);
+            break;
+
+        default:
+            break;
+    }
+}
+
+static void HarnessUartTx(uint8_t b)
+{
+    uint16_t need;
+
+    if (TxLen == 0 && b != 0x55) return;
+    if (TxLen == 1 && b != 0xAA)
+    {
+        TxLen = 0;
+        return;
+    }
+    TxFrame[TxLen++] = b;
+    if (TxLen < 6) return;
+
+    need = 7 + ((TxFrame[4] << 8) | TxFrame[5]);
+    if (need > sizeof(TxFrame)) Fail(get_milliseconds_now(), "oversized frame from the firmware");
+    if (TxLen < need) return;
+
+    {
+        uint8_t sum = 0;
+        uint16_t i;
+        for (i = 0; i < need - 1; i++) sum += TxFrame[i];
+        if (sum != TxFrame[need - 1]) Fail(get_milliseconds_now(), "bad checksum from the firmware");
+    }
+    ModuleReceived(get_milliseconds_now(), TxFrame, need - 1);
+    TxLen = 0;
+}
+
+//////////////////////////////////////////////////////////////////////
+
+static void Finish(uint32_t now)
+{
+    bool nominal = Sc.door.stuck < 0 && !Sc.door.obstruct && !Sc.door.missed &&
+                   Sc.door.travel <= NOMINAL_TRAVEL_MAX && !Sc.cloud_open_used && !Sc.interfered;
+
+    if (Sc.door.dir) Fail(now, "door still moving at the end");
+    if (Reported < 0) Fail(now, "door state never reported");
+    if (Reported != DoorSensor()) Fail(now, "app shows a stale door state");
+    if (nominal && Sc.door.pos) Fail(now, "door left open");
+    Trace(now, "end, relay presses", Presses);
+    Trace(now, "reports lost offline", LostReports);
+    exit(0);
+}
+
+static uint32_t HarnessWake(uint32_t now)
+{
+    uint32_t next = Sc.end;
+    uint32_t t;
+
+    DoorAdvance(now);
+
+    if (HalHostPins.relay != RelayWas)
+    {
+        RelayWas = HalHostPins.relay;
+        if (RelayWas)
+        {
+            PulseStart = now;
+            Presses++;
+            if (WallPressAt != NEVER && now - WallPressAt < Sc.door.travel) Sc.interfered = true;
+            DoorPress(now);
+        }
+        else if (now - PulseStart > RELAY_PULSE_MAX)
+        {
+            Fail(now, "relay held too long");
+        }
+    }
+    if (RelayWas && now - PulseStart > RELAY_PULSE_MAX) Fail(now, "relay held too long");
+
+    while (NextAction < Sc.action_count && Sc.actions[NextAction].at <= now)
+    {
+        const S_ACTION* a = &Sc.actions[NextAction++];
+        bool offline = !CloudUp || now < ModuleBackAt;
+        Trace(now, ActionNames[a->what], a->arg);
+        switch (a->what)
+        {
+            case ACT_WALL_PRESS:
+                if (Sc.door.dir) Sc.interfered = true;
+                WallPressAt = now;
+                DoorPress(now);
+                break;
+            case ACT_CLOUD_OPEN:  if (!offline) ModuleCommandDoor(true);  break;
+            case ACT_CLOUD_CLOSE: if (!offline) ModuleCommandDoor(false); break;
+            case ACT_BUTTON_DOWN: HalHostSetButton(true);       break;
+            case ACT_BUTTON_UP:   HalHostSetButton(false);      break;
+            case ACT_WIFI_DOWN:
+            case ACT_WIFI_UP:
+            {
+                const uint8_t status = a->what == ACT_WIFI_UP ? NET_STATUS_CLOUD : NET_STATUS_ROUTER_ONLY;
+                CloudUp = a->what == ACT_WIFI_UP;
+                ModuleSend(0x03, &status, 1);
+                break;
+            }
+            case ACT_MODULE_REBOOT:
+                ModuleBackAt = now + a->arg;
+                NextHeartbeat = ModuleBackAt; // Then the handshake, from the start
+                LinkUp = false;
+                break;
+        }
+    }
+    if (NextAction < Sc.action_count && Sc.actions[NextAction].at < next)
+    {
+        next = Sc.actions[NextAction].at;
+    }
+
+    if (now >= NextHeartbeat && now >= ModuleBackAt)
+    {
+        ModuleSend(0x00, 0, 0);
+        NextHeartbeat = now + HEARTBEAT_PERIOD;
+    }
+    if (NextHeartbeat < next) next = NextHeartbeat;
+
+    HalHostSetSensor(DoorSensor());
+    t = DoorNext(now);
+    if (t < next) next = t;
+
+    if (now >= Sc.end) Finish(now);
+    return next;
+}
+
+static const S_HAL_HOST_HARNESS SimHarness = { HarnessUartTx, HarnessWake };
+
+//////////////////////////////////////////////////////////////////////
+// Firmware update: the application takes the upgrade start and resets into
+// the bootloader, which has to take the image and start it only if its CRC
+// checks out.
+
+static void OtaFinish(uint32_t now, bool started)
+{
+    const uint8_t* flash = HAL_FLASH(OTA_APP_BASE);
+    S_OTA_RECORD record;
+    uint16_t i;
+
+    OtaRecordLoad(&record);
+    if (!Ota.in_boot) Fail(now, "never reset into the bootloader");
+    if (Ota.variant == OTA_BAD_CRC)
+    {
+        if (started) Fail(now, "started an image with a bad CRC");
+        if (Ota.ended) Fail(now, "acknowledged the end of a bad image");
+        if (record.state != OTA_RECEIVING) Fail(now, "bad image not left marked as receiving");
+    }
+    else
+    {
+        if (!started) Fail(now, "new image never started");
+        if (Ota.acked != Ota.size) Fail(now, "started before the whole image was in");
+        if (record.state != OTA_IDLE) Fail(now, "OTA record not cleared");
+        if (memcmp(flash, Ota.image, Ota.size)) Fail(now, "flash doesn't match the image");
+    }
+    for (i = 0; i < HAL_HOST_FLASH_SIZE; i++)
+    {
+        uint16_t addr = HAL_HOST_FLASH_BASE + i;
+        if ((addr < OTA_APP_BASE || addr >= OTA_APP_END) && HalHostFlash[i])
+        {
+            Fail(now, "wrote outside the application region");
+        }
+    }
+    Trace(now, "packages sent", Ota.packages);
+    exit(0);
+}
+
+static uint32_t OtaWake(uint32_t now)
+{
+    uint32_t next = OTA_TIME_MAX;
+
+    if (now >= OTA_TIME_MAX) OtaFinish(now, false);
+
+    if (now >= NextHeartbeat)
+    {
+        ModuleSend(0x00, 0, 0);
+        NextHeartbeat = now + HEARTBEAT_PERIOD;
+    }
+    if (NextHeartbeat < next) next = NextHeartbeat;
+
+    if (!Ota.started && now >= OTA_START_AT && Reported >= 0)
+    {
+        const uint8_t size[4] = { 0, 0, Ota.size >> 8, Ota.size & 0xFF };
+        Trace(now, "upgrade start", Ota.size);
+        ModuleSend(0x0A, size, sizeof(size));
+        Ota.started = true;
+    }
+    if (!Ota.started && OTA_START_AT < next) next = OTA_START_AT;
+
+    if (Ota.sent_at != NEVER && !Ota.ended)
+    {
+        if (now - Ota.sent_at >= OTA_RETRY_TIME)
+        {
+            Trace(now, "resend", Ota.acked);
+            ModuleSendPackage(now);
+        }
+        if (Ota.sent_at + OTA_RETRY_TIME < next) next = Ota.sent_at + OTA_RETRY_TIME;
+    }
+    return next;
+}
+
+static void OtaReset(void)
+{
+    longjmp(OtaBoot, 1);
+}
+
+static void OtaStartApp(void)
+{
+    OtaFinish(get_milliseconds_now(), true);
+}
+
+static const S_HAL_HOST_HARNESS OtaHarness = { HarnessUartTx, OtaWake, OtaReset, OtaStartApp };
+
+static void MakeOtaRun(uint32_t seed)
+{
+    uint16_t crc = 0xFFFF;
+    uint16_t i;
+
+    memset(&Sc, 0, sizeof(Sc));
+    memset(&Ota, 0, sizeof(Ota));
+    Sc.seed = seed;
+    Sc.door.stuck = -1;
+    Ota.variant = seed % OTA_VARIANTS;
+    Ota.size = RandRange(OTA_IMAGE_MAX / 2, OTA_IMAGE_MAX);
+    Ota.corrupt = RandRange(0, Ota.size / OTA_PACKAGE_SIZE);
+    Ota.sent_at = NEVER;
+    for (i = 0; i < Ota.size - 2; i++)
+    {
+        Ota.image[i] = Rand();
+        crc = OtaCrc16(crc, Ota.image[i]);
+    }
+    if (Ota.variant == OTA_BAD_CRC) crc ^= 0x0100;
+    Ota.image[Ota.size - 2] = crc >> 8;
+    Ota.image[Ota.size - 1] = crc & 0xFF;
+}
+
+//////////////////////////////////////////////////////////////////////
+// Settings and the event log across a power cut: a first boot changes the
+// settings from the cloud and the button, then loses power; a second boot,
+// from what the EEPROM was left holding, has to report the settings and use
+// them, and give the log back whole.
+
+static const char* const OpNames[] = {
+    "lockdown write", "lockdown button", "resend", "auto-close write", "travel write"
+};
+
+static uint32_t OpSpacing(void)
+{
+    // Mostly seconds apart, now and then long enough for the log's coarse gaps.
+    return Rand() % 4 ? RandRange(SECONDS(1), SECONDS(8)) : RandRange(SECONDS(8), SECONDS(900));
+}
+
+static void PersistReported(uint32_t now, uint8_t dp, const uint8_t* data, uint16_t len)
+{
+    S_PERSIST_RUN* r = Persist;
+    S_SETTINGS was = r->settings;
+    uint32_t value = 0;
+    uint16_t i;
+
+    for (i = 0; i < len && i < 4; i++) value = (value << 8) | data[i];
+
+    if (PersistBoot == 2)
+    {
+        if (dp == 0x68 && !r->lockdown_seen)
+        {
+            r->lockdown_seen = true;
+            r->lockdown = value;
+            Trace(now, "reported lockdown", value);
+        }
+        if (dp == 0x01 && value && !r->open_at) r->open_at = now;
+        if (dp == 0x01 && !value && r->close_at && !r->closed_at)
+        {
+            r->closed_at = now;
+            PageAt = now + SECONDS(2);
+        }
+        if (dp == 0x67 && len == sizeof(S_EVENTLOG_PAGE) && r->pages_in < EVENTLOG_PAGES)
+        {
+            memcpy(&r->pages[r->pages_in++], data, len);
+            PageAt = now;
+        }
+        return;
+    }
+
+    if (dp == 0x68) r->settings.lockdown = value;
+    if (dp == 0x69) r->settings.auto_close_s = value;
+    if (dp == 0x6A) r->settings.travel_s = value;
+    if (memcmp(&was, &r->settings, sizeof(was)))
+    {
+        if (++r->changes > PERSIST_CHANGES_MAX) Fail(now, "too many changes for the run");
+        r->previous = was;
+        Trace(now, "setting changed", dp);
+        if (dp == 0x68)
+        {
+            S_PERSIST_RECORD* rec = &r->records[r->record_count++];
+            rec->type = EVENTLOG_LOCKDOWN;
+            rec->arg = value;
+            rec->at = now;
+        }
+    }
+    if (dp == AwaitDp)
+    {
+        AwaitDp = 0;
+        OpAt = now + OpSpacing();
+        if (OpsDone == PersistOps) CutAt = now + RandRange(SECONDS(1), SECONDS(5));
+    }
+}
+
+static void PersistOp(uint32_t now)
+{
+    S_PERSIST_RUN* r = Persist;
+    static const uint8_t LastOps[] = { OP_LOCKDOWN, OP_AUTO_CLOSE, OP_TRAVEL }; // Changes, from the cloud
+    bool last = OpsDone + 1 == PersistOps;
+    uint8_t op = last ? LastOps[Rand() % sizeof(LastOps)] : Rand() % OPS;
+    uint32_t value;
+
+    r->before = r->settings;
+    r->after = r->settings;
+    r->settled_records = r->record_count;
+    switch (op)
+    {
+        case OP_LOCKDOWN:
+            r->after.lockdown = !r->settings.lockdown;
+            ModuleWriteDp(0x68, 0x01, r->after.lockdown);
+            AwaitDp = 0x68;
+            break;
+        case OP_BUTTON:
+            r->after.lockdown = !r->settings.lockdown;
+            HalHostSetButton(true);
+            ButtonHeld = true;
+            OpAt = now + RandRange(50, 1000);
+            AwaitDp = 0x68;
+            break;
+        case OP_RESEND:
+            if (Rand() % 2)
+            {
+                ModuleWriteDp(0x68, 0x01, r->settings.lockdown);
+                AwaitDp = 0x68;
+            }
+            else
+            {
+                ModuleWriteDp(0x69, 0x02, r->settings.auto_close_s);
+                AwaitDp = 0x69;
+            }
+            break;
+        case OP_AUTO_CLOSE:
+            do value = RandRange(CONFIG_AUTO_CLOSE_S_MIN, 300); while (value == r->settings.auto_close_s);
+            r->after.auto_close_s = value;
+            ModuleWriteDp(0x69, 0x02, value);
+            AwaitDp = 0x69;
+            break;
+        default:
+            do value = RandRange(15, CONFIG_TRAVEL_S_MAX); while (value == r->settings.travel_s);
+            r->after.travel_s = value;
+            ModuleWriteDp(0x6A, 0x02, value);
+            AwaitDp = 0x6A;
+            break;
+    }
+    Trace(now, OpNames[op], AwaitDp);
+    AwaitUntil = (ButtonHeld ? OpAt : now) + PERSIST_CONFIRM_MAX;
+    OpsDone++;
+    if (last && r->variant == PERSIST_MID_SAVE)
+    {
+        r->pending_record = op == OP_LOCKDOWN;
+        CutAt = now + RandRange(0, PERSIST_CUT_MID_MAX);
+        AwaitDp = 0;
+    }
+}
+
+static uint32_t PersistFirstBoot(uint32_t now)
+{
+    if (CutAt != NEVER)
+    {
+        if (now < CutAt) return CutAt;
+        Persist->torn = HalHostEepromCut(RandRange(0, HAL_EEPROM_WORD - 1));
+        Trace(now, "power cut, torn word", Persist->torn);
+        exit(0);
+    }
+    if (ButtonHeld)
+    {
+        if (now < OpAt) return OpAt;
+        HalHostSetButton(false);
+        ButtonHeld = false;
+    }
+    if (AwaitDp)
+    {
+        if (now >= AwaitUntil) Fail(now, "never reported back");
+        return AwaitUntil;
+    }
+    if (Reported < 0 || OpsDone == PersistOps) return NEVER; // Handshake first
+    if (now < OpAt) return OpAt;
+    PersistOp(now);
+    return ButtonHeld ? OpAt : AwaitDp ? AwaitUntil : CutAt;
+}
+
+// Within what a record's gap can be out by: a second either way for when in
+// its second each end fell, and the log scale's 12.5%.
+static bool GapOk(uint8_t gap, uint32_t ms)
+{
+    uint32_t s = ms / 1000;
+    uint32_t g = EVENTLOG_GAP_S(gap);
+
+    return g <= s + 1 && g + 1 >= s - s / 8;
+}
+
+static void PersistCheckLog(uint32_t now)
+{
+    const S_PERSIST_RUN* r = Persist;
+    S_EVENTLOG_RECORD got[EVENTLOG_SLOTS];
+    uint8_t at[EVENTLOG_SLOTS];  // Slot each came from
+    uint8_t count = 0;
+    uint8_t head = r->pages[0].head;
+    uint8_t settled = r->pending_record ? r->settled_records : r->record_count;
+    uint8_t written;             // By the first boot
+    uint8_t extra;               // The pending record, in the log
+    uint8_t old;                 // The first boot's, in the log
+    uint8_t i;
+
+    for (i = 0; i < EVENTLOG_PAGES; i++)
+    {
+        if (r->pages[i].page != i || r->pages[i].head != head) Fail(now, "log pages don't agree");
+        if (r->pages[i].lost) Fail(now, "log records lost");
+    }
+
+    // Oldest first: slots never written, then an unbroken run of sequence numbers.
+    for (i = 0; i < EVENTLOG_SLOTS; i++)
+    {
+        uint8_t slot = (head + i) % EVENTLOG_SLOTS;
+        const S_EVENTLOG_RECORD* rec = &r->pages[slot / EVENTLOG_PAGE_SLOTS].records[slot % EVENTLOG_PAGE_SLOTS];
+
+        if (!rec->seq)
+        {
+            if (count) Fail(now, "blank slot in the log");
+            continue;
+        }
+        if (count && rec->seq != got[count - 1].seq + 1) Fail(now, "log out of sequence");
+        at[count] = slot;
+        got[count++] = *rec;
+    }
+
+    // The second boot's: BOOT, and the close after the auto-close.
+    if (count < 2) Fail(now, "log too short");
+    if (got[count - 2].type != EVENTLOG_BOOT || got[count - 2].gap) Fail(now, "no boot record");
+    if (got[count - 1].type != EVENTLOG_CLOSED || !GapOk(got[count - 1].gap, r->closed_at))
+    {
+        Fail(now, "close not logged");
+    }
+    if (got[count - 1].arg < PERSIST_TRAVEL / 100 || got[count - 1].arg > PERSIST_TRAVEL / 100 + 10)
+    {
+        Fail(now, "close logged with the wrong travel time");
+    }
+
+    // The first boot's: the newest of what it logged, resends not among them,
+    // and the pending record in or not, whole unless the cut tore it.
+    written = got[count - 2].seq - 1; // From a blank EEPROM, so numbered from 1
+    extra = written - settled;
+    if (written < settled || extra > r->pending_record) Fail(now, "log doesn't hold what was done");
+    if (count != (written + 2 < EVENTLOG_SLOTS ? written + 2 : EVENTLOG_SLOTS)) Fail(now, "log lost records");
+    old = count - 2;
+    if (extra && EVENTLOG_OFFSET + at[old - 1] * sizeof(S_EVENTLOG_RECORD) != (unsigned)r->torn &&
+        (got[old - 1].type != EVENTLOG_LOCKDOWN || got[old - 1].arg != r->after.lockdown))
+    {
+        Fail(now, "pending lockdown logged wrong");
+    }
+    for (i = 0; i < old - extra; i++)
+    {
+        uint8_t e = settled - (old - extra) + i;
+        const S_PERSIST_RECORD* want = &r->records[e];
+
+        if (got[i].type != want->type || got[i].arg != want->arg) Fail(now, "log record not as done");
+        if (e ? !GapOk(got[i].gap, want->at - r->records[e - 1].at) : got[i].gap != 0)
+        {
+            Fail(now, "log gap wrong");
+        }
+    }
+    Trace(now, "log records", count);
+}
+
+static void PersistFinish(uint32_t now)
+{
+    const S_PERSIST_RUN* r = Persist;
+    S_SETTINGS could[2]; // What the config may have come back as
+    uint8_t n = 0;
+    uint8_t i;
+
+    if (r->variant == PERSIST_SETTLED) could[n++] = r->settings;
+    if (r->variant == PERSIST_MID_SAVE)
+    {
+        could[n++] = r->before;
+        could[n++] = r->after;
+    }
+    if (r->variant == PERSIST_BIT_ROT) could[n++] = r->previous; // The other copy
+
+    // Lockdown as reported, and the times from when the auto-close came.
+    if (!r->lockdown_seen) Fail(now, "lockdown never reported");
+    for (i = 0; i < n; i++)
+    {
+        int32_t off = (int32_t)(r->close_at - r->open_at - SECONDS(could[i].auto_close_s + could[i].travel_s));
+        if (could[i].lockdown == r->lockdown && off > -500 && off < 500) break;
+    }
+    if (i == n) Fail(now, "settings not as saved");
+    Trace(now, "settings as saved, candidate", i);
+
+    PersistCheckLog(now);
+    exit(0);
+}
+
+static uint32_t PersistSecondBoot(uint32_t now)
+{
+    if (Reported < 0) return NEVER;
+    if (OpAt <= now)
+    {
+        Trace(now, "wall press", 0); // Open, for the auto-close to time
+        DoorPress(now);
+        OpAt = NEVER;
+    }
+    if (PageAt <= now)
+    {
+        if (Persist->pages_in == EVENTLOG_PAGES) PersistFinish(now);
+        ModuleWriteDp(0x67, 0x00, Persist->pages_in);
+        PageAt = NEVER;
+    }
+    return OpAt < PageAt ? OpAt : PageAt;
+}
+
+static uint32_t PersistWake(uint32_t now)
+{
+    uint32_t next;
+    uint32_t t;
+
+    if (now >= PERSIST_TIME_MAX) Fail(now, "run never finished");
+    DoorAdvance(now);
+
+    if (HalHostPins.relay != RelayWas)
+    {
+        RelayWas = HalHostPins.relay;
+        if (RelayWas && PersistBoot == 1) Fail(now, "relay pressed with nobody asking");
+        if (RelayWas)
+        {
+            if (!Persist->close_at) Persist->close_at = now;
+            Trace(now, "auto-close", now - Persist->open_at);
+            DoorPress(now);
+        }
+    }
+
+    if (now >= NextHeartbeat)
+    {
+        ModuleSend(0x00, 0, 0);
+        NextHeartbeat = now + HEARTBEAT_PERIOD;
+    }
+    next = NextHeartbeat;
+
+    t = PersistBoot == 1 ? PersistFirstBoot(now) : PersistSecondBoot(now);
+    if (t < next) next = t;
+
+    HalHostSetSensor(DoorSensor());
+    if (Sc.door.dir && now + 100 < next) next = now + 100; // Sensor edges on time
+    t = DoorNext(now);
+    if (t < next) next = t;
+    if (PERSIST_TIME_MAX < next) next = PERSIST_TIME_MAX;
+    return next;
+}
+
+static const S_HAL_HOST_HARNESS PersistHarness = { HarnessUartTx, PersistWake };
+
+// A bit of the newer config copy flips while the power is off.
+static void RotNewerCopy(void)
+{
+    uint8_t eeprom[HAL_HOST_EEPROM_SIZE];
+    S_CONFIG copies[CONFIG_COPIES];
+    FILE* f = fopen(getenv(EEPROM_ENV), "r+b");
+    uint8_t newer;
+    uint8_t at;
+
+    if (!f || fread(eeprom, 1, sizeof(eeprom), f) != sizeof(eeprom)) Fail(0, "no EEPROM from the first boot");
+    memcpy(copies, &eeprom[CONFIG_OFFSET], sizeof(copies));
+    newer = (int8_t)(copies[1].seq - copies[0].seq) > 0;
+    at = CONFIG_OFFSET + newer * sizeof(S_CONFIG) + RandRange(0, sizeof(S_CONFIG) - 1);
+    eeprom[at] ^= 1 << RandRange(0, 7);
+    Trace(0, "bit rot at", at);
+    rewind(f);
+    if (fwrite(eeprom, 1, sizeof(eeprom), f) != sizeof(eeprom)) Fail(0, "EEPROM not written back");
+    fclose(f);
+}
+
+static void PersistBootChild(uint32_t seed)
+{
+    S_PERSIST_RUN* r = Persist;
+
+    memset(&Sc, 0, sizeof(Sc));
+    Sc.seed = seed;
+    Sc.door.travel = PERSIST_TRAVEL;
+    Sc.door.stuck = -1;
+    Sc.door.last_dir = -1;
+    OpAt = PERSIST_OPS_AT;
+    if (PersistBoot == 1)
+    {
+        r->settings.lockdown = 0;
+        r->settings.travel_s = CONFIG_TRAVEL_S;
+        r->settings.auto_close_s = CONFIG_AUTO_CLOSE_S;
+        r->previous = r->settings;
+        r->records[0].type = EVENTLOG_BOOT;
+        r->record_count = 1;
+        r->torn = -1;
+        PersistOps = Rand() % 2 ? RandRange(30, 60) : RandRange(1, 12);
+        if (Verbose) printf("seed %u: %s, %u ops\n", seed, PersistVariantNames[r->variant], PersistOps);
+    }
+    else
+    {
+        if (Verbose) printf("seed %u: power back\n", seed);
+        if (r->variant == PERSIST_BIT_ROT) RotNewerCopy();
+    }
+    HalHostAttach(&PersistHarness);
+    FirmwareMain();
+}
+
+//////////////////////////////////////////////////////////////////////
+
+static void AddAction(uint32_t at, uint8_t what, uint32_t arg)
+{
+    if (Sc.action_count < ACTIONS_MAX)
+    {
+        Sc.actions[Sc.action_count].at = at;
+        Sc.actions[Sc.action_count].what = what;
+        Sc.actions[Sc.action_count].arg = arg;
+        Sc.action_count++;
+    }
+}
+
+static void MakeScenario(uint32_t seed)
+{
+    uint8_t n;
+    uint8_t i;
+    uint32_t at = SECONDS(2);
+    uint32_t out;
+
+    memset(&Sc, 0, sizeof(Sc));
+    Sc.seed = seed;
+    Sc.door.travel = RandRange(SECONDS(8), SECONDS(24));
+    Sc.door.stuck = -1;
+    Sc.door.last_dir = -1;
+    if (Rand() % 8 == 0) Sc.door.stuck = Rand() % 2;
+    if (Rand() % 8 == 0) Sc.door.obstruct = RandRange(1, Sc.door.travel - 1);
+    if (Rand() % 8 == 0) Sc.door.missed = RandRange(1, 3);
+
+    n = RandRange(1, 4);
+    for (i = 0; i < n; i++)
+    {
+        if (Sc.action_count + 4 > ACTIONS_MAX) break; // Room for any of them, whole
+        at += RandRange(SECONDS(1), SECONDS(200));
+        switch (Rand() % 6)
+        {
+            case 0:
+                AddAction(at, ACT_WALL_PRESS, 0);
+                break;
+            case 1:
+                AddAction(at, ACT_CLOUD_OPEN, 0);
+                Sc.cloud_open_used = true;
+                break;
+            case 2:
+                AddAction(at, ACT_CLOUD_CLOSE, 0);
+                break;
+            case 3: // Double press on the unit: close now
+                AddAction(at, ACT_BUTTON_DOWN, 0);
+                AddAction(at + 100, ACT_BUTTON_UP, 0);
+                AddAction(at + 200, ACT_BUTTON_DOWN, 0);
+                AddAction(at + 300, ACT_BUTTON_UP, 0);
+                break;
+            case 4: // Cloud outage, with the door used during it
+                out = RandRange(SECONDS(5), SECONDS(180));
+                AddAction(at, ACT_WIFI_DOWN, 0);
+                AddAction(at + RandRange(0, out / 2), ACT_WALL_PRESS, 0);
+                AddAction(at + out, ACT_WIFI_UP, 0);
+                at += out;
+                break;
+            default: // Module reboot, likewise
+                out = RandRange(SECONDS(5), SECONDS(90));
+                AddAction(at, ACT_MODULE_REBOOT, out);
+                AddAction(at + RandRange(0, out / 2), ACT_WALL_PRESS, 0);
+                at += out;
+                break;
+        }
+    }
+    Sc.end = at + SETTLE_TIME;
+}
+
+static int RunScenario(uint32_t seed, E_RUN run)
+{
+    pid_t pid;
+    int status;
+
+    fflush(stdout);
+    pid = fork();
+    if (pid < 0)
+    {
+        perror("fork");
+        exit(2);
+    }
+    if (pid == 0 && run == RUN_PERSIST)
+    {
+        PersistBootChild(seed);
+        exit(3); // Never returns
+    }
+    if (pid == 0 && run == RUN_OTA)
+    {
+        MakeOtaRun(seed);
+        if (Verbose)
+        {
+            printf("seed %u: %s, %u bytes\n", seed, OtaVariantNames[Ota.variant], Ota.size);
+        }
+        HalHostAttach(&OtaHarness);
+        if (!setjmp(OtaBoot))
+        {
+            FirmwareMain();
+            exit(3); // Never returns
+        }
+        Ota.in_boot = true;
+        Trace(get_milliseconds_now(), "reset into bootloader", 0);
+        BootMain();
+        exit(3);
+    }
+    if (pid == 0)
+    {
+        MakeScenario(seed);
+        if (Verbose)
+        {
+            printf("seed %u: travel %u ms, stuck %d, obstruct %u, missed %u\n", seed,
+                   Sc.door.travel, Sc.door.stuck, Sc.door.obstruct, Sc.door.missed);
+        }
+        HalHostAttach(&SimHarness);
+        FirmwareMain();
+        exit(3); // Never returns
+    }
+    waitpid(pid, &status, 0);
+    if (WIFEXITED(status)) return WEXITSTATUS(status);
+    printf("seed %u: crashed (signal %d)\n", seed, WTERMSIG(status));
+    return 4;
+}
+
+// Both boots, in turn, from one EEPROM file that starts out blank.
+static int RunPersist(uint32_t seed)
+{
+    char path[] = "/tmp/garagedoor-sim-XXXXXX";
+    int fd = mkstemp(path);
+    int result = 0;
+
+    if (fd < 0)
+    {
+        perror("mkstemp");
+        exit(2);
+    }
+    close(fd);
+    setenv(EEPROM_ENV, path, 1);
+    if (!Persist)
+    {
+        Persist = mmap(0, sizeof(*Persist), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+        if (Persist == MAP_FAILED)
+        {
+            perror("mmap");
+            exit(2);
+        }
+    }
+    memset(Persist, 0, sizeof(*Persist));
+    Persist->variant = seed % PERSIST_VARIANTS;
+    for (PersistBoot = 1; PersistBoot <= 2 && !result; PersistBoot++)
+    {
+        result = RunScenario(seed, RUN_PERSIST);
+    }
+    unlink(path);
+    return result;
+}
+
+int main(int argc, char** argv)
+{
+    uint32_t count = 1000;
+    uint32_t first = 1;
+    uint32_t failed = 0;
+    uint32_t i;
+    uint32_t seed;
+    struct timespec t0, t1;
+    E_RUN run = RUN_DOOR;
+
+    if (argc > 1 && !strcmp(argv[1], "-u"))
+    {
+        run = RUN_OTA;
+        count = OTA_VARIANTS * 10;
+        argc--;
+        argv++;
+    }
+    else if (argc > 1 && !strcmp(argv[1], "-p"))
+    {
+        run = RUN_PERSIST;
+        count = PERSIST_VARIANTS * 100;
+        argc--;
+        argv++;
+    }
+    if (argc == 3 && !strcmp(argv[1], "-s"))
+    {
+        Verbose = true;
+        seed = strtoul(argv[2], 0, 0);
+        return run == RUN_PERSIST ? RunPersist(seed) : RunScenario(seed, run);
+    }
+    if (argc > 1) count = strtoul(argv[1], 0, 0);
+    if (argc > 2) first = strtoul(argv[2], 0, 0);
+
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    for (i = 0; i < count; i++)
+    {
+        if (run == RUN_PERSIST ? RunPersist(first + i) : RunScenario(first + i, run)) failed++;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+
+    printf("%u scenarios, %u failed, %.2f s\n", count, failed,
+           (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9);
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,741 @@
+// Tuya Wi-Fi module emulator. Plays the module's side of the serial protocol
+// against the firmware: the host build on a pseudo-terminal, or a board on a
+// serial port. It does the boot handshake, heartbeats and pairing acks, runs
+// command scripts, and can load the link at line rate to measure the MCU.
+//
+//   tuyamod [options] [script]
+//     -x exe      Run exe (e.g. build/garagedoor) on a new pty
+//     -d device   Use a serial port at 9600 8N1
+//                 (default: open a pty and print its name)
+//     -b baud     Line rate to pace frames at (default 9600, 0 = unpaced)
+//     -S seconds  Stress: back-to-back frames, corrupted and truncated ones,
+//                 and commands, interleaved at random; then report
+//     -s seed     Stress mix seed (default 1)
+//     -v          Print every frame
+//
+// Script lines, run after the handshake:
+//   wait <ms>
+//   heartbeat | product | mcu | query | net <status>
+//   dp <dpid> bool|value|enum <n>     Command one datapoint
+//   dp <dpid> raw <hex bytes>
+//   send <opcode> [hex bytes]         Any frame
+//   expect <opcode> [timeout ms]      Wait for a frame from the MCU, or fail
+//
+// Every frame that has an answer is timed from when it was written to when
+// the answer's last byte came in; ones left unanswered for REPLY_TIMEOUT_MS count as
+// dropped. The report goes to stdout when the script or stress run ends.
+#define _DEFAULT_SOURCE
+#define _XOPEN_SOURCE 600
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <termios.h>
+#include <time.h>
+#include <sys/wait.h>
+
+#define UART_ENV "GARAGEDOOR_UART"
+
+#define HEARTBEAT_PERIOD_MS  15000
+#define REPLY_TIMEOUT_MS     1000
+#define HANDSHAKE_TIMEOUT_MS 5000
+#define OUTSTANDING_MAX      256
+#define FRAME_MAX            1100
+#define SCRIPT_LINE_MAX      256
+
+#define DPID_LATENCY 0x66 // A write is always answered: see datapoints.h
+#define DPID_DOOR    0x01 // Moves the door; the state machine reports in its own time
+
+enum
+{
+    OP_HEARTBEAT = 0x00,
+    OP_PRODUCT_INFO = 0x01,
+    OP_QUERY_MCU = 0x02,
+    OP_NETWORK_STATUS = 0x03,
+    OP_RESET_WIFI = 0x04,
+    OP_PAIRING_MODE = 0x05,
+    OP_COMMAND = 0x06,
+    OP_STATUS = 0x07,
+    OP_QUERY_STATUS = 0x08,
+    OP_COUNT
+};
+
+static const char* const OpNames[OP_COUNT] = {
+    "heartbeat", "product info", "query mcu", "network status", "reset wifi",
+    "pairing mode", "command", "status", "query status"
+};
+
+// What the MCU sends back for each opcode it receives, or -1 for nothing.
+static const int8_t ReplyTo[OP_COUNT] = {
+    OP_HEARTBEAT, OP_PRODUCT_INFO, OP_QUERY_MCU, OP_NETWORK_STATUS, -1,
+    -1, OP_STATUS, -1, OP_STATUS
+};
+
+typedef struct
+{
+    uint32_t sent;
+    uint32_t answered;
+    uint32_t dropped;
+    double min_ms;
+    double max_ms;
+    double total_ms;
+} S_OP_STATS;
+
+typedef struct
+{
+    uint8_t opcode; // What was sent
+    double at;      // When it was written (on a real port: when it had left)
+} S_OUTSTANDING;
+
+static int Fd = -1;
+static pid_t Child = 0;
+static uint32_t Baud = 9600;
+static bool Verbose = false;
+static bool Drain = false; // Wait for each frame to leave a real port
+
+static double LineFree = 0; // When the last queued byte will have left
+static double Start;
+static double NextHeartbeat = 0;
+
+static S_OP_STATS Stats[OP_COUNT];
+static S_OUTSTANDING Outstanding[OUTSTANDING_MAX];
+static uint16_t OutHead = 0;
+static uint16_t OutTail = 0;
+
+static uint32_t SentFrames = 0;
+static uint32_t SentBytes = 0;
+static uint32_t SentCorrupt = 0;
+static uint32_t Untimed = 0; // Sent while too many were outstanding to track
+static uint32_t RxFrames = 0;
+static uint32_t RxBytes = 0;
+static uint32_t RxBad = 0;
+static uint32_t RxCount[OP_COUNT + 1]; // Last: anything else
+
+static uint8_t RxFrame[FRAME_MAX];
+static uint16_t RxLen = 0;
+static bool Handshaken = false;
+
+//////////////////////////////////////////////////////////////////////
+
+static double Now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1e6;
+}
+
+static const char* OpName(uint8_t opcode)
+{
+    static char other[8];
+    if (opcode < OP_COUNT) return OpNames[opcode];
+    snprintf(other, sizeof(other), "0x%02X", opcode);
+    return other;
+}
+
+static void Die(const char* why)
+{
+    fprintf(stderr, "tuyamod: %s\n", why);
+    if (Child) kill(Child, SIGTERM);
+    exit(1);
+}
+
+static void PrintFrame(const char* dir, const uint8_t* f, uint16_t len)
+{
+    uint16_t i;
+
+    if (!Verbose) return;
+    printf("%9.3f %s %-15s", (Now() - Start) / 1000.0, dir, len >= 4 ? OpName(f[3]) : "?");
+    for (i = 0; i < len; i++) printf(" %02X", f[i]);
+    printf("\n");
+    fflush(stdout);
+}
+
+//////////////////////////////////////////////////////////////////////
+// Sending
+
+static void WriteAll(const uint8_t* bytes, uint16_t len)
+{
+    while (len)
+    {
+        ssize_t n = write(Fd, bytes, len);
+        if (n < 0) Die("write failed");
+        bytes += n;
+        len -= n;
+    }
+}
+
+// Holds off until the line is free, so frames go out back to back at Baud.
+static void Pace(uint16_t len)
+{
+    double now = Now();
+    double wait;
+
+    if (!Baud) return;
+    if (LineFree < now) LineFree = now;
+    wait = LineFree - now;
+    if (wait > 0) usleep((useconds_t)(wait * 1000));
+    LineFree += len * 10 * 1000.0 / Baud; // 8N1: ten bits a byte
+}
+
+static void Outstand(uint8_t opcode, double at)
+{
+    uint16_t next = (OutHead + 1) % OUTSTANDING_MAX;
+
+    if (next == OutTail)
+    {
+        Untimed++;
+        return;
+    }
+    Outstanding[OutHead].opcode = opcode;
+    Outstanding[OutHead].at = at;
+    OutHead = next;
+    Stats[opcode].sent++;
+}
+
+enum
+{
+    FRAME_BAD_SUM = 1 << 0,
+    FRAME_CUT = 1 << 1,      // Stops halfway through the payload
+    FRAME_NO_REPLY = 1 << 2  // Not answered right away, so not timed
+};
+
+static void SendFrame(uint8_t opcode, const uint8_t* payload, uint16_t len, uint8_t flags)
+{
+    uint8_t frame[FRAME_MAX];
+    uint16_t total = len + 7;
+    uint8_t sum = 0;
+    uint16_t i;
+
+    frame[0] = 0x55;
+    frame[1] = 0xAA;
+    frame[2] = 0x00;
+    frame[3] = opcode;
+    frame[4] = len >> 8;
+    frame[5] = len & 0xFF;
+    memcpy(frame + 6, payload, len);
+    for (i = 0; i < len + 6; i++) sum += frame[i];
+    frame[len + 6] = (flags & FRAME_BAD_SUM) ? ~sum : sum;
+    if (flags & FRAME_CUT) total = 6 + len / 2;
+
+    Pace(total);
+    WriteAll(frame, total);
+    if (Drain) tcdrain(Fd); // A real port: time from when it's left
+    PrintFrame((flags & (FRAME_BAD_SUM | FRAME_CUT)) ? "tx!" : "tx ", frame, total);
+
+    SentFrames++;
+    SentBytes += total;
+    if (flags & (FRAME_BAD_SUM | FRAME_CUT))
+    {
+        SentCorrupt++;
+    }
+    else if (!(flags & FRAME_NO_REPLY) && opcode < OP_COUNT && ReplyTo[opcode] >= 0)
+    {
+        Outstand(opcode, Now());
+    }
+}
+
+static void SendDp(uint8_t dpid, uint8_t type, const uint8_t* value, uint16_t len)
+{
+    uint8_t dp[FRAME_MAX];
+
+    dp[0] = dpid;
+    dp[1] = type;
+    dp[2] = len >> 8;
+    dp[3] = len & 0xFF;
+    memcpy(dp + 4, value, len);
+    SendFrame(OP_COMMAND, dp, len + 4, dpid == DPID_DOOR ? FRAME_NO_REPLY : 0);
+}
+
+static void SendNetworkStatus(uint8_t status)
+{
+    SendFrame(OP_NETWORK_STATUS, &status, 1, 0);
+}
+
+//////////////////////////////////////////////////////////////////////
+// Receiving
+
+static void Answered(uint8_t reply)
+{
+    double now = Now();
+    uint16_t i;
+
+    // Expire what's waited too long, then match the oldest request this answers.
+    while (OutTail != OutHead && now - Outstanding[OutTail].at > REPLY_TIMEOUT_MS)
+    {
+        Stats[Outstanding[OutTail].opcode].dropped++;
+        OutTail = (OutTail + 1) % OUTSTANDING_MAX;
+    }
+    for (i = OutTail; i != OutHead; i = (i + 1) % OUTSTANDING_MAX)
+    {
+        S_OUTSTANDING* o = &Outstanding[i];
+        S_OP_STATS* s;
+        double ms;
+
+        if (ReplyTo[o->opcode] != reply) continue;
+
+        s = &Stats[o->opcode];
+        ms = now - o->at;
+        if (ms < 0) ms = 0; // Answered before our estimate of the wire time
+        if (!s->answered || ms < s->min_ms) s->min_ms = ms;
+        if (ms > s->max_ms) s->max_ms = ms;
+        s->total_ms += ms;
+        s->answered++;
+
+        // Close the gap; the ring keeps its order.
+        while (i != OutTail)
+        {
+            uint16_t prev = (i + OUTSTANDING_MAX - 1) % OUTSTANDING_MAX;
+            Outstanding[i] = Outstanding[prev];
+            i = prev;
+        }
+        OutTail = (OutTail + 1) % OUTSTANDING_MAX;
+        return;
+    }
+}
+
+static void Received(const uint8_t* f, uint16_t len)
+{
+    uint8_t opcode = f[3];
+
+    PrintFrame("rx ", f, len);
+    RxFrames++;
+    RxCount[opcode < OP_COUNT ? opcode : OP_COUNT]++;
+    if (opcode < OP_COUNT) Answered(opcode);
+
+    // What the real module does unprompted.
+    switch (opcode)
+    {
+        case OP_RESET_WIFI:
+            SendFrame(OP_RESET_WIFI, 0, 0, 0);
+            break;
+
+        case OP_PAIRING_MODE:
+            SendFrame(OP_PAIRING_MODE, 0, 0, 0);
+            SendNetworkStatus(len > 7 && f[6] ? 0x01 : 0x00); // AP or smart config
+            break;
+
+        default:
+            break;
+    }
+}
+
+static void ReceiveByte(uint8_t b)
+{
+    uint16_t need;
+    uint8_t sum = 0;
+    uint16_t i;
+
+    RxBytes++;
+    if ((RxLen == 0 && b != 0x55) || (RxLen == 1 && b != 0xAA))
+    {
+        RxLen = 0;
+        return;
+    }
+    RxFrame[RxLen++] = b;
+    if (RxLen < 6) return;
+
+    need = 7 + ((RxFrame[4] << 8) | RxFrame[5]);
+    if (need > FRAME_MAX)
+    {
+        RxBad++;
+        RxLen = 0;
+        return;
+    }
+    if (RxLen < need) return;
+
+    RxLen = 0;
+    for (i = 0; i < need - 1; i++) sum += RxFrame[i];
+    if (sum != RxFrame[need - 1])
+    {
+        RxBad++;
+        return;
+    }
+    Received(RxFrame, need);
+}
+
+// Takes in whatever the MCU sent for up to ms, and keeps the heartbeat going.
+static void Pump(double ms)
+{
+    double until = Now() + ms;
+    struct pollfd pfd;
+    uint8_t buf[256];
+    ssize_t n;
+    ssize_t i;
+    double left;
+
+    do
+    {
+        if (Handshaken && Now() >= NextHeartbeat)
+        {
+            NextHeartbeat = Now() + HEARTBEAT_PERIOD_MS;
+            SendFrame(OP_HEARTBEAT, 0, 0, 0);
+        }
+        left = until - Now();
+        if (left < 0) left = 0;
+        pfd.fd = Fd;
+        pfd.events = POLLIN;
+        if (poll(&pfd, 1, (int)left) > 0)
+        {
+            n = read(Fd, buf, sizeof(buf));
+            if (n <= 0) Die("the MCU side went away");
+            for (i = 0; i < n; i++) ReceiveByte(buf[i]);
+        }
+    } while (Now() < until);
+}
+
+// Pumps until a frame with this opcode comes in. False on timeout.
+static bool Expect(uint8_t opcode, double ms)
+{
+    uint32_t before = RxCount[opcode < OP_COUNT ? opcode : OP_COUNT];
+    double until = Now() + ms;
+
+    while (Now() < until)
+    {
+        Pump(10);
+        if (RxCount[opcode < OP_COUNT ? opcode : OP_COUNT] != before) return true;
+    }
+    return false;
+}
+
+//////////////////////////////////////////////////////////////////////
+
+static void Handshake(void)
+{
+    static const uint8_t order[] = { OP_PRODUCT_INFO, OP_QUERY_MCU };
+    double until = Now() + HANDSHAKE_TIMEOUT_MS;
+    uint8_t i;
+
+    // Heartbeats until the MCU answers, then the rest one answer at a time.
+    do
+    {
+        if (Now() > until) Die("no answer to heartbeats");
+        SendFrame(OP_HEARTBEAT, 0, 0, 0);
+    } while (!Expect(OP_HEARTBEAT, 500));
+
+    for (i = 0; i < sizeof(order); i++)
+    {
+        SendFrame(order[i], 0, 0, 0);
+        if (!Expect(order[i], REPLY_TIMEOUT_MS)) Die("handshake not answered");
+    }
+    SendNetworkStatus(0x04); // Connected to the router
+    Expect(OP_NETWORK_STATUS, REPLY_TIMEOUT_MS);
+    SendFrame(OP_QUERY_STATUS, 0, 0, 0);
+    Expect(OP_STATUS, REPLY_TIMEOUT_MS);
+
+    Handshaken = true;
+    NextHeartbeat = Now() + HEARTBEAT_PERIOD_MS;
+}
+
+static uint16_t ParseHex(char* s, uint8_t* out, uint16_t max)
+{
+    uint16_t n = 0;
+    char* tok;
+
+    for (tok = strtok(s, " \t\r\n"); tok && n < max; tok = strtok(0, " \t\r\n"))
+    {
+        out[n++] = (uint8_t)strtoul(tok, 0, 16);
+    }
+    return n;
+}
+
+static void RunScript(FILE* f)
+{
+    char line[SCRIPT_LINE_MAX];
+    unsigned lineno = 0;
+
+    while (fgets(line, sizeof(line), f))
+    {
+        char cmd[16] = "";
+        char type[8] = "";
+        unsigned a = 0;
+        unsigned b = 0;
+        int used = 0;
+        int more = 0;
+        uint8_t bytes[FRAME_MAX];
+        uint16_t n;
+
+        lineno++;
+        if (sscanf(line, "%15s%n", cmd, &used) != 1 || cmd[0] == '#') continue;
+
+        if (!strcmp(cmd, "wait") && sscanf(line + used, "%u", &a) == 1)
+        {
+            Pump(a);
+        }
+        else if (!strcmp(cmd, "heartbeat"))
+        {
+            SendFrame(OP_HEARTBEAT, 0, 0, 0);
+        }
+        else if (!strcmp(cmd, "product"))
+        {
+            SendFrame(OP_PRODUCT_INFO, 0, 0, 0);
+        }
+        else if (!strcmp(cmd, "mcu"))
+        {
+            SendFrame(OP_QUERY_MCU, 0, 0, 0);
+        }
+        else if (!strcmp(cmd, "query"))
+        {
+            SendFrame(OP_QUERY_STATUS, 0, 0, 0);
+        }
+        else if (!strcmp(cmd, "net") && sscanf(line + used, "%u", &a) == 1)
+        {
+            SendNetworkStatus(a);
+        }
+        else if (!strcmp(cmd, "dp") && sscanf(line + used, "%u %7s%n", &a, type, &more) == 2)
+        {
+            char* rest = line + used + more;
+            if (!strcmp(type, "raw"))
+            {
+                n = ParseHex(rest, bytes, sizeof(bytes) - 4);
+                SendDp(a, 0x00, bytes, n);
+            }
+            else
+            {
+                b = strtoul(rest, 0, 0);
+                if (!strcmp(type, "bool") || !strcmp(type, "enum"))
+                {
+                    bytes[0] = b;
+                    SendDp(a, !strcmp(type, "bool") ? 0x01 : 0x04, bytes, 1);
+                }
+                else
+                {
+                    bytes[0] = b >> 24;
+                    bytes[1] = b >> 16;
+                    bytes[2] = b >> 8;
+                    bytes[3] = b;
+                    SendDp(a, 0x02, bytes, 4);
+                }
+            }
+        }
+        else if (!strcmp(cmd, "send") && sscanf(line + used, "%x%n", &a, &more) == 1)
+        {
+            n = ParseHex(line + used + more, bytes, sizeof(bytes) - 7);
+            SendFrame(a, bytes, n, 0);
+        }
+        else if (!strcmp(cmd, "expect") && sscanf(line + used, "%x %u", &a, &b) >= 1)
+        {
+            if (!Expect(a, b ? b : REPLY_TIMEOUT_MS))
+            {
+                fprintf(stderr, "tuyamod: line %u: no %s frame\n", lineno, OpName(a));
+                if (Child) kill(Child, SIGTERM);
+                exit(1);
+            }
+        }
+        else
+        {
+            fprintf(stderr, "tuyamod: line %u: can't parse: %s", lineno, line);
+            exit(2);
+        }
+    }
+    Pump(REPLY_TIMEOUT_MS); // Let the last answers in
+}
+
+static void Stress(double seconds, uint32_t seed)
+{
+    double until = Now() + seconds * 1000;
+    uint8_t value[4];
+    bool door = false;
+
+    srand(seed);
+    while (Now() < until)
+    {
+        int r = rand() % 100;
+
+        if (r < 35)
+        {
+            SendFrame(OP_HEARTBEAT, 0, 0, 0);
+        }
+        else if (r < 50)
+        {
+            SendFrame(OP_QUERY_STATUS, 0, 0, 0);
+        }
+        else if (r < 70)
+        {
+            value[0] = 0;
+            SendDp(DPID_LATENCY, 0x00, value, 1);
+        }
+        else if (r < 75)
+        {
+            door = !door;
+            value[0] = door;
+            SendDp(DPID_DOOR, 0x01, value, 1);
+        }
+        else if (r < 80)
+        {
+            SendNetworkStatus(0x04);
+        }
+        else if (r < 88)
+        {
+            SendFrame(OP_QUERY_STATUS, 0, 0, FRAME_BAD_SUM);
+        }
+        else if (r < 94)
+        {
+            value[0] = 0;
+            value[1] = 0x01;
+            value[2] = 0x00;
+            value[3] = 0x01;
+            SendFrame(OP_COMMAND, value, 4, FRAME_CUT);
+        }
+        else
+        {
+            SendFrame(OP_QUERY_MCU, 0, 0, 0);
+        }
+        Pump(0);
+    }
+    Pump(REPLY_TIMEOUT_MS);
+}
+
+static void Report(void)
+{
+    double secs = (Now() - Start) / 1000.0;
+    uint8_t i;
+
+    // Whatever is still waiting has waited long enough by now.
+    while (OutTail != OutHead)
+    {
+        Stats[Outstanding[OutTail].opcode].dropped++;
+        OutTail = (OutTail + 1) % OUTSTANDING_MAX;
+    }
+
+    printf("%.1f s\n", secs);
+    printf("sent     %6u frames %7u bytes %8.1f B/s  (%u corrupt)\n",
+           SentFrames, SentBytes, SentBytes / secs, SentCorrupt);
+    printf("received %6u frames %7u bytes %8.1f B/s  (%u bad)\n",
+           RxFrames, RxBytes, RxBytes / secs, RxBad);
+    if (Untimed) printf("%u frames not timed: more than %u were waiting for answers\n", Untimed, OUTSTANDING_MAX - 1);
+    printf("%-15s %7s %8s %7s %8s %8s %8s\n", "opcode", "sent", "answered", "dropped",
+           "min ms", "mean ms", "max ms");
+    for (i = 0; i < OP_COUNT; i++)
+    {
+        const S_OP_STATS* s = &Stats[i];
+        if (!s->sent) continue;
+        printf("%-15s %7u %8u %7u %8.2f %8.2f %8.2f\n", OpNames[i], s->sent, s->answered,
+               s->dropped, s->min_ms, s->answered ? s->total_ms / s->answered : 0.0, s->max_ms);
+    }
+}
+
+//////////////////////////////////////////////////////////////////////
+
+static void RawMode(int fd)
+{
+    struct termios t;
+
+    if (tcgetattr(fd, &t) < 0) return;
+    cfmakeraw(&t);
+    cfsetispeed(&t, B9600);
+    cfsetospeed(&t, B9600);
+    tcsetattr(fd, TCSANOW, &t);
+}
+
+static int OpenPty(char* name, size_t size)
+{
+    int master = posix_openpt(O_RDWR | O_NOCTTY);
+    int slave;
+
+    if (master < 0 || grantpt(master) < 0 || unlockpt(master) < 0) Die("no pty");
+    snprintf(name, size, "%s", ptsname(master));
+
+    // Raw on the MCU's side too, and held open so the line never hangs up.
+    slave = open(name, O_RDWR | O_NOCTTY);
+    if (slave < 0) Die("can't open the pty");
+    RawMode(slave);
+    RawMode(master);
+    return master;
+}
+
+static void Spawn(const char* exe, const char* pty)
+{
+    Child = fork();
+    if (Child < 0) Die("fork failed");
+    if (Child == 0)
+    {
+        int null = open("/dev/null", O_RDWR);
+        dup2(null, STDIN_FILENO);
+        dup2(null, STDOUT_FILENO);
+        setenv(UART_ENV, pty, 1);
+        execl(exe, exe, (char*)0);
+        _exit(127);
+    }
+}
+
+int main(int argc, char** argv)
+{
+    const char* device = 0;
+    const char* exe = 0;
+    double stress = 0;
+    uint32_t seed = 1;
+    char pty[64];
+    FILE* script = 0;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "x:d:b:S:s:v")) != -1)
+    {
+        switch (opt)
+        {
+            case 'x': exe = optarg; break;
+            case 'd': device = optarg; break;
+            case 'b': Baud = strtoul(optarg, 0, 0); break;
+            case 'S': stress = strtod(optarg, 0); break;
+            case 's': seed = strtoul(optarg, 0, 0); break;
+            case 'v': Verbose = true; break;
+            default:
+                fprintf(stderr, "usage: tuyamod [-x exe | -d device] [-b baud] [-S seconds [-s seed]] [-v] [script]\n");
+                return 2;
+        }
+    }
+    if (optind < argc)
+    {
+        script = fopen(argv[optind], "r");
+        if (!script) Die("can't open the script");
+    }
+
+    if (device)
+    {
+        Fd = open(device, O_RDWR | O_NOCTTY);
+        if (Fd < 0) Die("can't open the device");
+        RawMode(Fd);
+        Drain = true;
+    }
+    else
+    {
+        Fd = OpenPty(pty, sizeof(pty));
+        if (exe)
+        {
+            Spawn(exe, pty);
+        }
+        else
+        {
+            printf("%s\n", pty);
+            fflush(stdout);
+        }
+    }
+
+    Start = Now();
+    Handshake();
+
+    if (script)
+    {
+        RunScript(script);
+    }
+    else if (stress > 0)
+    {
+        Stress(stress, seed);
+    }
+    else
+    {
+        for (;;) Pump(1000); // Be the module until killed
+    }
+
+    Report();
+    if (Child)
+    {
+        kill(Child, SIGTERM);
+        waitpid(Child, 0, 0);
+    }
+    return 0;
+}
@@ -0,0 +1,53 @@
+#include <stdint.h>
+#include "hal.h"
+#include "latency.h"
+#include "time.h"
+
+HAL_NEAR S_LATENCY Latency;
+
+static HAL_CYCLES_T LoopStart;
+static uint32_t LoopStartMs;
+
+// Only the host's count is wider than the fields.
+#if HAL_CYCLES_MAX > 0xFFFF
+static uint16_t Saturate(HAL_CYCLES_T cycles)
+{
+    return (cycles > 0xFFFF) ? 0xFFFF : (uint16_t)cycles;
+}
+#else
+#define Saturate(cycles) (cycles)
+#endif
+
+void LatencyLoopBegin(void)
+{
+    LoopStart = HalCycles();
+    LoopStartMs = get_milliseconds_now();
+}
+
+void LatencyLoopEnd(void)
+{
+    HAL_CYCLES_T cycles = (HAL_CYCLES_T)(HalCycles() - LoopStart);
+    HAL_CYCLES_T rest = cycles >> LATENCY_BUCKET0_SHIFT;
+    uint8_t bucket = 0;
+
+    if (get_milliseconds_now() - LoopStartMs >= LATENCY_LONG_MS)
+    {
+        bucket = LATENCY_BUCKETS - 1;
+        cycles = 0xFFFF;
+    }
+    while (rest && bucket < LATENCY_BUCKETS - 1)
+    {
+        rest >>= 1;
+        bucket++;
+    }
+
+    if (Latency.loop_hist[bucket] != 0xFFFF) Latency.loop_hist[bucket]++;
+    if (Saturate(cycles) > Latency.loop_max) Latency.loop_max = Saturate(cycles);
+}
+
+void LatencyIsrDone(uint8_t isr, HAL_CYCLES_T start)
+{
+    uint16_t cycles = Saturate((HAL_CYCLES_T)(HalCycles() - start));
+
+    if (cycles > Latency.isr_max[isr]) Latency.isr_max[isr] = cycles;
+}
@@ -0,0 +1,48 @@
+#pragma once
+#include <stdint.h>
+#include "hal.h"
+
+// Field latency profile, always built in. Reported as raw datapoint 0x66 (see
+// datapoints.h) exactly as it sits in RAM, which on the STM8 means
+// big-endian. Durations are in HalCycles() counts: CPU cycles on the board.
+// Everything saturates rather than wraps.
+//
+// Loop passes go in log2 buckets: bucket 0 is under LATENCY_BUCKET0 cycles,
+// each next one twice as wide, and the last also takes any pass that spanned
+// LATENCY_LONG_MS of the millisecond clock, which the 16-bit count can't.
+#define LATENCY_BUCKETS 8
+#define LATENCY_BUCKET0_SHIFT 9 // 512 cycles, 256 us at 2 MHz
+#define LATENCY_LONG_MS 16
+
+typedef enum
+{
+    LATENCY_ISR_SENSOR,  // IRQ5
+    LATENCY_ISR_BUTTON,  // IRQ6
+    LATENCY_ISR_UART_TX, // IRQ17
+    LATENCY_ISR_UART_RX, // IRQ18
+    LATENCY_ISR_TICK,    // IRQ23, LED tick included
+    LATENCY_ISR_COUNT
+} E_LATENCY_ISR;
+
+// The datapoint's wire layout: keep the 16-bit fields first so it packs the
+// same on every compiler.
+typedef struct
+{
+    uint16_t loop_hist[LATENCY_BUCKETS];
+    uint16_t loop_max;
+    uint16_t isr_max[LATENCY_ISR_COUNT];
+    uint16_t uart_overruns;  // Bytes lost in the UART itself (OR flag)
+    uint16_t uart_framing;   // Bytes received with a framing error (FE flag)
+    uint16_t rx_ring_full;   // Bytes lost because RxTask() fell behind
+    uint8_t rx_depth_max;    // Most bytes seen waiting in the RX ring
+    uint8_t tx_depth_max;    // Most bytes seen queued in the TX ring
+} S_LATENCY;
+
+void LatencyLoopBegin(void);
+
+void LatencyLoopEnd(void);
+
+// Called from the vectors, with HalCycles() as of entry.
+void LatencyIsrDone(uint8_t isr, HAL_CYCLES_T start);
+
+extern HAL_NEAR S_LATENCY Latency;
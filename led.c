@@ -0,0 +1,108 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include "hal.h"
+#include "led.h"
+
+// PD2 and PD3 aren't timer outputs on this package without remapping option
+// bytes, so the LEDs are driven by a sequencer on the 1 ms tick instead.
+// Each step holds a red and a blue duty for a number of milliseconds. The
+// duty is applied as software PWM over LED_PWM_STEPS ticks (125 Hz), with red
+// at the start of the period and blue at the end, so two duties that add up
+// to LED_PWM_STEPS or less never overlap, and larger ones do.
+#define LED_PWM_STEPS 8 /* must be a power of 2 */
+#define FULL LED_PWM_STEPS
+
+typedef struct
+{
+    uint8_t red;  // 0..LED_PWM_STEPS
+    uint8_t blue; // 0..LED_PWM_STEPS
+    uint16_t ms;
+} S_LED_STEP;
+
+typedef struct
+{
+    const S_LED_STEP* steps;
+    uint8_t count;
+} S_LED_PATTERN;
+
+#define PINK_R 3 /* 3/8 red, 5/8 blue */
+#define PINK_B 5
+
+static const S_LED_STEP Off[]          = { {0, 0, 1000} };
+static const S_LED_STEP Blue[]         = { {0, FULL, 1000} };
+static const S_LED_STEP Red[]          = { {FULL, 0, 1000} };
+static const S_LED_STEP BlueRedBlink[] = { {0, FULL, 100}, {FULL, FULL, 100} };
+static const S_LED_STEP BlueBlink[]    = { {0, 0, 100}, {0, FULL, 100} };
+static const S_LED_STEP RedFlash[]     = { {0, 0, 180}, {FULL, 0, 20} };
+static const S_LED_STEP Pink[]         = { {PINK_R, PINK_B, 1000} };
+static const S_LED_STEP PinkCode1[]    = { {PINK_R, PINK_B, 1800}, {0, 0, 200} };
+static const S_LED_STEP PinkCode2[]    = { {PINK_R, PINK_B, 1400}, {0, 0, 200},
+                                           {PINK_R, PINK_B, 200}, {0, 0, 200} };
+static const S_LED_STEP PinkBlink[]    = { {0, 0, 50}, {PINK_R, PINK_B, 50} };
+
+#define PATTERN(steps) { steps, sizeof(steps) / sizeof(steps[0]) }
+
+static const S_LED_PATTERN Patterns[LED_PATTERN_COUNT] = {
+    PATTERN(Off),          // LED_ALL_OFF
+    PATTERN(Blue),         // LED_BLUE
+    PATTERN(Red),          // LED_RED
+    PATTERN(BlueRedBlink), // LED_BLUE_RED_BLINK
+    PATTERN(BlueBlink),    // LED_BLUE_BLINK
+    PATTERN(RedFlash),     // LED_RED_FLASH
+    PATTERN(Pink),         // LED_PINK
+    PATTERN(PinkCode1),    // LED_PINK_CODE_1
+    PATTERN(PinkCode2),    // LED_PINK_CODE_2
+    PATTERN(PinkBlink)     // LED_PINK_BLINK
+};
+
+static volatile uint8_t Requested = LED_ALL_OFF;     // Written by LedSetPattern() only
+static uint8_t Current = LED_PATTERN_COUNT;          // Forces a restart on the first tick
+static uint8_t Step;
+static uint16_t StepLeft;
+static uint8_t Phase;
+
+void LedSetPattern(E_LED_PATTERN pattern)
+{
+    // A single byte store, so no locking against LedTick().
+    Requested = pattern;
+}
+
+void LedTick(void)
+{
+    const S_LED_PATTERN* pattern;
+    const S_LED_STEP* step;
+
+    if (Current != Requested)
+    {
+        Current = Requested;
+        Step = 0;
+        StepLeft = Patterns[Current].steps[0].ms;
+    }
+    pattern = &Patterns[Current];
+    step = &pattern->steps[Step];
+
+    Phase = (Phase + 1) & (LED_PWM_STEPS - 1);
+    if (Phase < step->red)
+    {
+        RED_LED_ON();
+    }
+    else
+    {
+        RED_LED_OFF();
+    }
+    if (Phase >= LED_PWM_STEPS - step->blue)
+    {
+        BLUE_LED_ON();
+    }
+    else
+    {
+        BLUE_LED_OFF();
+    }
+
+    if (--StepLeft == 0)
+    {
+        Step++;
+        if (Step >= pattern->count) Step = 0;
+        StepLeft = pattern->steps[Step].ms;
+    }
+}
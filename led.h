@@ -0,0 +1,22 @@
+#pragma once
+#include <stdint.h>
+
+// LED patterns, named by what they look like. See the tables in led.c.
+typedef enum
+{
+    LED_ALL_OFF,
+    LED_BLUE,
+    LED_RED,
+    LED_BLUE_RED_BLINK, // Blue steady, red blinking
+    LED_BLUE_BLINK,
+    LED_RED_FLASH,      // Short red flash every 200 ms
+    LED_PINK,
+    LED_PINK_CODE_1,    // Pink, one dark blink every 2 s
+    LED_PINK_CODE_2,    // Pink, two dark blinks every 2 s
+    LED_PINK_BLINK,
+    LED_PATTERN_COUNT
+} E_LED_PATTERN;
+
+void LedSetPattern(E_LED_PATTERN pattern);
+
+void LedTick(void);
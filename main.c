@@ -1,480 +1,576 @@
 #include <stdint.h>
 #include <stdbool.h>
-#include <iostm8s003.h>
-#include "MyPeripherals.h"
+#include "hal.h"
 #include "time.h"
 #include "tuya.h"
-
-#define INTERRUPT_EN()   __asm("RIM")
-#define INTERRUPT_DIS()  __asm("SIM")
+#include "power.h"
+#include "sensor.h"
+#include "button.h"
+#include "led.h"
+#include "event.h"
+#include "bench.h"
+#include "latency.h"
+#include "trace.h"
+#include "eventlog.h"
+#include "config.h"
 
 /// States...
-static int State_WatchDoor(void);
-static int State_Wait2Minutes(void);
-static int State_Door_Closing(void);
-static int State_Close_Command(void);
-static int State_CloseError(void);
-static int State_Open_Command(void);
-static int State_Door_Opening(void);
-static int State_Idle(void);
-static int State_OpenError(void);
-
-int (*state)(void) = State_WatchDoor;
+typedef enum
+{
+    STATE_WATCH_DOOR,
+    STATE_WAIT_2_MINUTES,
+    STATE_OPEN_COMMAND,
+    STATE_DOOR_OPENING,
+    STATE_OPEN_ERROR,
+    STATE_IDLE,
+    STATE_CLOSE_COMMAND,
+    STATE_DOOR_CLOSING,
+    STATE_CLOSE_ERROR,
+    STATE_COUNT
+} E_STATE;
+
+typedef struct
+{
+    E_STATE (*run)(const S_EVENT* e); // Evaluated per event; returns the next state.
+    void (*entry)(void);    // Runs once when the state is entered. May be NULL.
+    void (*exit)(void);     // Runs once when the state is left. May be NULL.
+    E_LED_PATTERN led;      // LED pattern shown while in this state.
+    bool busy;              // Door in motion: commands wait for the next state.
+} S_STATE;
+
+static E_STATE State_WatchDoor(const S_EVENT* e);
+static E_STATE State_Wait2Minutes(const S_EVENT* e);
+static E_STATE State_Door_Closing(const S_EVENT* e);
+static E_STATE State_Close_Command(const S_EVENT* e);
+static E_STATE State_CloseError(const S_EVENT* e);
+static E_STATE State_Open_Command(const S_EVENT* e);
+static E_STATE State_Door_Opening(const S_EVENT* e);
+static E_STATE State_Idle(const S_EVENT* e);
+static E_STATE State_OpenError(const S_EVENT* e);
+
+static void Enter_WatchDoor(void);
+static void Enter_Wait2Minutes(void);
+static void Enter_Idle(void);
+static void Enter_RelayPulse(void);
+static void Enter_DoorTravel(void);
+static void Enter_OpenError(void);
+static void Enter_CloseError(void);
+static void Exit_Wait2Minutes(void);
+static void Exit_RelayPulse(void);
+static void Exit_DoorTravel(void);
+
+static const S_STATE States[STATE_COUNT] = {
+    /* STATE_WATCH_DOOR     */ { State_WatchDoor,     Enter_WatchDoor,    0,                 LED_BLUE,        false },
+    /* STATE_WAIT_2_MINUTES */ { State_Wait2Minutes,  Enter_Wait2Minutes, Exit_Wait2Minutes, LED_RED,         false },
+    /* STATE_OPEN_COMMAND   */ { State_Open_Command,  Enter_RelayPulse,   Exit_RelayPulse,   LED_ALL_OFF,     true  },
+    /* STATE_DOOR_OPENING   */ { State_Door_Opening,  Enter_DoorTravel,   Exit_DoorTravel,   LED_BLUE_BLINK,  true  },
+    /* STATE_OPEN_ERROR     */ { State_OpenError,     Enter_OpenError,    0,                 LED_PINK_CODE_1, false },
+    /* STATE_IDLE           */ { State_Idle,          Enter_Idle,         0,                 LED_RED_FLASH,   false },
+    /* STATE_CLOSE_COMMAND  */ { State_Close_Command, Enter_RelayPulse,   Exit_RelayPulse,   LED_ALL_OFF,     true  },
+    /* STATE_DOOR_CLOSING   */ { State_Door_Closing,  Enter_DoorTravel,   Exit_DoorTravel,   LED_BLUE_BLINK,  true  },
+    /* STATE_CLOSE_ERROR    */ { State_CloseError,    Enter_CloseError,   0,                 LED_PINK_CODE_2, false }
+};
+
+static E_STATE state = STATE_WATCH_DOOR;
+static const S_EVENT NoEvent = { 0, EVENT_NONE, 0, 0 };
+static S_EVENT Deferred = { 0, EVENT_NONE, 0, 0 }; // A command that came in while busy
 
 /// Tasks...
-static void LedTask(void);
-static void SensorTask(void);
-static void ButtonTask(void);
-
-/// Commands & statuses
-bool RxCommand_open;
-bool RxCommand_close;
-bool Sensor_closed;
-bool Sensor_open;
-bool Lockdown;
-bool NewState;
+static void UpdateLeds(void);
+
+/// Statuses
+static bool DoorIsOpen;   // Sensor level, as of the last EVENT_SENSOR
 
 void Event_ButtonPressedShort(void);
 void Event_ButtonPressedLong(void);
+void Event_ButtonPressedDouble(void);
 
 // other functions...
 void setup(void);
 void EnterStateMachine(void);
-bool FirstTime(void);
+static void Dispatch(const S_EVENT* e);
+static void StepStateMachine(const S_EVENT* e);
 
 void setup()
 {
     // GPIOs
-    LED_OFF();
-    PD_ODR  |= UART_TX_PIN;
-    PD_DDR  |= (BLUE_LED_PIN | RED_LED_PIN | UART_TX_PIN);
-    PC_DDR  |= DOOR_SWITCH_PIN;
-    PC_CR1  |= DOOR_SWITCH_PIN;
-    PD_CR1  |= (UART_TX_PIN ); 
+    HalGpioSetup();
+    ConfigLoad();
 
     // Others
     TimersSetup();
     UartSetup();
+    SensorSetup();
+    DoorIsOpen = SensorIsOpen();
+    ButtonSetup();
+    EventLogSetup();
+
+    // Straight into the state the door is in: after a power blip, an open
+    // door is closed again as if it had just been opened.
+    state = DoorIsOpen ? STATE_WAIT_2_MINUTES : STATE_WATCH_DOOR;
     INTERRUPT_EN();
 }
 
 void main()
 {
     setup();
-
-    // Test that notification function works:
-    RED_LED_ON();
-    SetNotification(0);
-    while (!IsTimePassed());
-    RED_LED_OFF();
-
     EnterStateMachine();
 }
 
 void EnterStateMachine()
 {
-    int next;
-    NewState = true;
+    S_SENSOR_EDGE edge;
+    E_BUTTON_GESTURE gesture;
+    S_EVENT e;
+    uint8_t work;
+
+    if (States[state].entry) States[state].entry();
+    StepStateMachine(&NoEvent); // The door may already be open
 
     for (;;)
     {
-        next = state();
-        LedTask();
-        RxTask();
-        TxTask();
-        SensorTask();
-        ButtonTask();
-        if (next != (int)state)
+        // Only run what an interrupt asked for, then sleep until the next one.
+        BENCH_BEGIN(BENCH_LOOP);
+        LatencyLoopBegin();
+        work = TakeWork();
+        if (work & WORK_RX)
+        {
+            BENCH_BEGIN(BENCH_RX_TASK);
+            RxTask();
+            BENCH_END(BENCH_RX_TASK);
+        }
+
+        while ((gesture = ButtonPopGesture()) != BUTTON_NONE)
         {
-            NewState = true;
+            EventPost(EVENT_BUTTON, gesture, get_milliseconds_now());
         }
-        state = (int(*)(void))next;
+
+        // One event per sensor edge, so a quick open/close pair isn't merged.
+        while (SensorPopEdge(&edge))
+        {
+            EventPost(EVENT_SENSOR, edge.open, edge.ms);
+        }
+
+        // Timer expiries are posted by the tick ISR; everything is handled in
+        // the order it was queued.
+        while (EventPop(&e) || TimerPopMissed(&e))
+        {
+            BENCH_BEGIN(BENCH_DISPATCH);
+            Dispatch(&e);
+            BENCH_END(BENCH_DISPATCH);
+        }
+
+        EventLogTask();
+        ConfigTask();
+
+        BENCH_BEGIN(BENCH_UPDATE_LEDS);
+        UpdateLeds();
+        BENCH_END(BENCH_UPDATE_LEDS);
+        BENCH_END(BENCH_LOOP);
+        LatencyLoopEnd();
+        SleepUntilWork();
     }
 }
 
-bool FirstTime(void)
+void Dispatch(const S_EVENT* e)
+{
+    TracePut(TRACE_EVENT, (e->type << 4) | (e->arg & 0x0F));
+    switch (e->type)
+    {
+        case EVENT_SENSOR:
+            DoorIsOpen = e->arg;
+            break;
+
+        case EVENT_TIMER:
+            if (e->seq != TimerGeneration(e->arg)) return; // Stopped or restarted since
+            break;
+
+        case EVENT_BUTTON:
+            switch (e->arg)
+            {
+                case BUTTON_SHORT:  Event_ButtonPressedShort();  return;
+                case BUTTON_LONG:   Event_ButtonPressedLong();   return;
+                case BUTTON_DOUBLE: Event_ButtonPressedDouble(); return;
+                default: return;
+            }
+
+        default:
+            break;
+    }
+    StepStateMachine(e);
+}
+
+void StepStateMachine(const S_EVENT* e)
 {
-    if (NewState)
+    bool command = (e->type == EVENT_CMD_OPEN || e->type == EVENT_CMD_CLOSE);
+    E_STATE next = States[state].run(e);
+
+    if (next == state)
+    {
+        // A command the door can't act on while it's moving is kept for the
+        // next state rather than dropped. Anywhere else it's just not wanted.
+        if (command && States[state].busy) Deferred = *e;
+        return;
+    }
+
+    // Let each new state look at the levels it was entered with, and hand it
+    // the deferred command, until things settle.
+    while (next != state)
     {
-        NewState = false;
-        return true;
+        if (States[state].exit) States[state].exit();
+        state = next;
+        TracePut(TRACE_STATE, state);
+        if (States[state].entry) States[state].entry();
+
+        if (Deferred.type != EVENT_NONE && !States[state].busy)
+        {
+            S_EVENT cmd = Deferred;
+            Deferred.type = EVENT_NONE;
+            next = States[state].run(&cmd);
+        }
+        else
+        {
+            next = States[state].run(&NoEvent);
+        }
     }
-    return false;
 }
 
 //////////////////////////////////////////////////////////////////////////
 ////////      STATE MACHINE LOGIC  ///////////////////////////////////////
 //////////////////////////////////////////////////////////////////////////
 
-#define GARAGE_DOOR_CLOSING_TIME    20 /* Actual time: 13.7s */
-#define GARAGE_DOOR_LET_OPEN_TIME (120 + GARAGE_DOOR_CLOSING_TIME)
+#define SECONDS(s) ((s) * 1000UL)
+
+// Settings, config.h
+#define GARAGE_DOOR_CLOSING_TIME  SECONDS(Config.travel_s)
+#define GARAGE_DOOR_LET_OPEN_TIME (SECONDS(Config.auto_close_s) + GARAGE_DOOR_CLOSING_TIME)
 
-#define RELAY_TIME_CLOSE 1          /* Original firmware uses about 3 */
+#define RELAY_TIME_CLOSE ((uint32_t)Config.relay_ms)
 
 #define CLOSE_RETIRES_MAX       3
 static int close_attempts_remaining;
 
-int State_WatchDoor()
+// Door travel, learned from the commands we send: from the relay press to the
+// sensor edge, and for a close from its first press, retries included.
+// Opening only takes the door off the reed switch; closing is the full run
+// down. Once TRAVEL_LEARN_MIN runs are in, an attempt is given up at the
+// estimate plus TRAVEL_DEVS deviations, at least TRAVEL_FLOOR of it, plus
+// TRAVEL_MARGIN; never later than the fixed GARAGE_DOOR_CLOSING_TIME it used
+// to wait. The first run seeds the deviation at half the time, so that only
+// undercuts the cap once the deviation has settled: for a 14 s close under
+// the 20 s default, from the eighth run on. An attempt that times out widens
+// the deviation, so a door that has got slower isn't given up on every time.
+#define TRAVEL_LEARN_MIN 3
+#define TRAVEL_DEVS      4
+#define TRAVEL_FLOOR(mean) ((mean) + (mean) / 4)
+#define TRAVEL_MARGIN    SECONDS(2)
+
+typedef struct
 {
-    if (FirstTime())
-    {
-        StatusReport(false,0x65); // 0x65 sends alarm/notification
-        StatusReport(false,1);
-        RxCommand_open = false;
-    }
+    uint16_t mean;    // ms
+    uint16_t dev;     // ms, mean deviation
+    uint8_t samples;  // Saturates at TRAVEL_LEARN_MIN
+} S_TRAVEL;
 
-    if (RxCommand_open && !Lockdown)
-    {
-        return (int)State_Open_Command;
-    }
-    if (Sensor_open)
-    {
-        return (int)State_Wait2Minutes;
-    }
-    return (int)State_WatchDoor;
+static S_TRAVEL OpenTravel;
+static S_TRAVEL CloseTravel;
+static uint32_t TravelStart; // When the relay was pressed
+static uint32_t CloseStart;  // When it was first pressed for this close
+
+#define TIMED_OUT(e, timer) ((e)->type == EVENT_TIMER && (e)->arg == (timer))
+
+// For the event log: tenths of a second, saturating.
+static uint8_t TravelTenths(uint32_t ms)
+{
+    return ms < 25500 ? (uint8_t)(ms / 100) : 0xFF;
 }
 
-int State_Open_Command()
+static void TravelLearn(S_TRAVEL* t, uint32_t ms)
 {
-    if (FirstTime())
+    int32_t err;
+
+    if (ms > GARAGE_DOOR_CLOSING_TIME + RELAY_TIME_CLOSE) return;
+    if (!t->samples)
     {
-        RELAY_CLOSE();
-        SetNotification(RELAY_TIME_CLOSE);
+        t->mean = (uint16_t)ms;
+        t->dev = (uint16_t)(ms / 2);
     }
-
-    if (IsTimePassed())
+    else
     {
-        RELAY_OPEN();
-        return (int)State_Door_Opening;
+        // Same gains as a TCP round trip estimator: 1/8 on the mean, 1/4 on
+        // the deviation, so one odd run moves the deadline out, not in.
+        err = (int32_t)ms - t->mean;
+        t->mean = (uint16_t)(t->mean + err / 8);
+        if (err < 0) err = -err;
+        t->dev = (uint16_t)(t->dev + (err - (int32_t)t->dev) / 4);
     }
-    return (int)State_Open_Command;
+    if (t->samples < TRAVEL_LEARN_MIN) t->samples++;
 }
 
-static int State_Door_Opening(void)
+// An attempt ran out: the door took longer than the estimate allowed for, by
+// how much isn't known. Doubling the deviation, like a TCP retransmit timeout
+// backing off, gets past it in a few attempts; clean runs shrink it again.
+static void TravelMissed(S_TRAVEL* t)
 {
-    if (FirstTime())
-    {
-        SetNotification(GARAGE_DOOR_CLOSING_TIME);
-    }
+    uint32_t dev = (uint32_t)t->dev * 2 + t->mean / 8;
 
-    if (IsTimePassed())
-    {
-        return (int)State_OpenError;
-    }
-    if (Sensor_open)
-    {
-        return (int)State_Idle;
-    }
-    return (int)State_Door_Opening;
+    t->dev = (uint16_t)(dev < GARAGE_DOOR_CLOSING_TIME ? dev : GARAGE_DOOR_CLOSING_TIME);
 }
 
-int State_OpenError()
+// How long the travel timer should still run, entered after the relay pulse.
+static uint32_t TravelTimeout(const S_TRAVEL* t)
 {
-    if (Sensor_open)
-    {
-        return (int)State_Idle;
-    }
+    uint32_t deadline = (uint32_t)t->mean + (uint32_t)t->dev * TRAVEL_DEVS;
+    uint32_t elapsed = get_milliseconds_since(TravelStart);
+
+    if (t->samples < TRAVEL_LEARN_MIN) return GARAGE_DOOR_CLOSING_TIME;
+    if (deadline < TRAVEL_FLOOR((uint32_t)t->mean)) deadline = TRAVEL_FLOOR((uint32_t)t->mean);
+    deadline += TRAVEL_MARGIN;
+    if (deadline <= elapsed) return 0;
+    deadline -= elapsed;
+    return deadline < GARAGE_DOOR_CLOSING_TIME ? deadline : GARAGE_DOOR_CLOSING_TIME;
 }
 
-int State_Idle()
+void Enter_WatchDoor()
 {
-    if (FirstTime())
-    {
-        RxCommand_close = false;
-        RxCommand_open = false;
-        StatusReport(true,0x65); // 0x65 sends alarm/notification
-        StatusReport(true,1);
-    }
+    StatusReport(false);
+}
 
-    if (RxCommand_close)
+E_STATE State_WatchDoor(const S_EVENT* e)
+{
+    if (e->type == EVENT_CMD_OPEN && !Config.lockdown)
     {
-        close_attempts_remaining = CLOSE_RETIRES_MAX;
-        return (int)State_Close_Command;
+        return STATE_OPEN_COMMAND;
     }
-    if (Sensor_closed)
+    if (DoorIsOpen)
     {
-        return (int)State_WatchDoor;
+        return STATE_WAIT_2_MINUTES;
     }
-    return (int)State_Idle;
+    return STATE_WATCH_DOOR;
 }
 
-int State_Wait2Minutes()
+// The closed edge, whichever close attempt it comes in.
+static void CloseLearn(uint32_t ms)
 {
-    if (FirstTime())
-    {
-        RxCommand_close = false;
-        StatusReport(true,0x65); // 0x65 sends alarm/notification
-        StatusReport(true,1);
-        SetNotification(GARAGE_DOOR_LET_OPEN_TIME);
-    }
+    TravelLearn(&CloseTravel, ms - CloseStart);
+    EventLogPut(EVENTLOG_CLOSED, TravelTenths(ms - TravelStart));
+}
 
-    if (Sensor_closed)
+void Enter_RelayPulse()
+{
+    RELAY_CLOSE();
+    TravelStart = get_milliseconds_now();
+    if (state == STATE_CLOSE_COMMAND && close_attempts_remaining == CLOSE_RETIRES_MAX)
     {
-        return (int)State_WatchDoor;
+        CloseStart = TravelStart;
     }
-    if (IsTimePassed() || RxCommand_close)
-    {
-        close_attempts_remaining = CLOSE_RETIRES_MAX;
-        return (int)State_Close_Command;
-    }
-    return (int)State_Wait2Minutes;
+    TimerStart(TIMER_RELAY, RELAY_TIME_CLOSE);
+}
+
+void Exit_RelayPulse()
+{
+    RELAY_OPEN();
+    TimerStop(TIMER_RELAY);
 }
 
-int State_Close_Command()
+E_STATE State_Open_Command(const S_EVENT* e)
 {
-    if (FirstTime())
+    if (e->type == EVENT_SENSOR && e->arg)
     {
-        RELAY_CLOSE();
-        SetNotification(RELAY_TIME_CLOSE);
+        TravelLearn(&OpenTravel, e->ms - TravelStart); // Usually off the switch before the pulse ends
+        EventLogPut(EVENTLOG_OPENED, TravelTenths(e->ms - TravelStart));
     }
-
-    if (IsTimePassed())
+    if (TIMED_OUT(e, TIMER_RELAY))
     {
-        RELAY_OPEN();
-        return (int)State_Door_Closing;
+        return STATE_DOOR_OPENING;
     }
-    return (int)State_Close_Command;
+    return STATE_OPEN_COMMAND;
 }
 
-int State_Door_Closing()
+void Enter_DoorTravel()
 {
-    if (FirstTime())
-    {
-        SetNotification(GARAGE_DOOR_CLOSING_TIME);
-    }
+    TimerStart(TIMER_DOOR_TRAVEL,
+               TravelTimeout(state == STATE_DOOR_OPENING ? &OpenTravel : &CloseTravel));
+}
 
-    if (Sensor_closed)
+void Exit_DoorTravel()
+{
+    TimerStop(TIMER_DOOR_TRAVEL);
+}
+
+E_STATE State_Door_Opening(const S_EVENT* e)
+{
+    if (TIMED_OUT(e, TIMER_DOOR_TRAVEL))
     {
-        return (int)State_WatchDoor;
+        TravelMissed(&OpenTravel);
+        return STATE_OPEN_ERROR;
     }
-    if (IsTimePassed())
+    if (DoorIsOpen)
     {
-        if ((close_attempts_remaining-1) > 0) // -1 for the one already happened
-        {
-            close_attempts_remaining--;
-            return (int)State_Close_Command;
-        }
-        else
+        if (e->type == EVENT_SENSOR)
         {
-            return (int)State_CloseError;
+            TravelLearn(&OpenTravel, e->ms - TravelStart);
+            EventLogPut(EVENTLOG_OPENED, TravelTenths(e->ms - TravelStart));
         }
-        
+        return STATE_IDLE;
     }
-    return (int)State_Door_Closing;
+    return STATE_DOOR_OPENING;
 }
 
-int State_CloseError()
+void Enter_OpenError()
 {
-    if (Sensor_closed)
-    {
-        return (int)State_WatchDoor;
-    }
-
-    return (int)State_CloseError;
+    EventLogPut(EVENTLOG_OPEN_ERROR, 0);
 }
 
-
-//////////////////////////////////////////////////////////////////////////
-//////////////////////////////////////////////////////////////////////////
-//////////////////////////////////////////////////////////////////////////
-
-#define BLINK_FREQ_MS 200
-
-void BLUE_LED_BLINK(void)
+E_STATE State_OpenError(const S_EVENT* e)
 {
-    if ((get_milliseconds_now() % BLINK_FREQ_MS) > (BLINK_FREQ_MS/2))
+    if (DoorIsOpen)
     {
-        BLUE_LED_ON();
-    }
-    else
-    {
-        BLUE_LED_OFF();
+        if (e->type == EVENT_SENSOR)
+        {
+            TravelLearn(&OpenTravel, e->ms - TravelStart); // Late, but it went
+        }
+        return STATE_IDLE;
     }
+    return STATE_OPEN_ERROR;
 }
 
-void RED_LED_BLINK(void)
+void Enter_Idle()
 {
-    if ((get_milliseconds_now() % BLINK_FREQ_MS) > (BLINK_FREQ_MS/2))
-    {
-        RED_LED_ON();
-    }
-    else
-    {
-        RED_LED_OFF();
-    }
+    StatusReport(true);
 }
 
-void RED_LED_BLINK_SLOW(void)
+E_STATE State_Idle(const S_EVENT* e)
 {
-    if ((get_milliseconds_now() % BLINK_FREQ_MS) > (BLINK_FREQ_MS*0.9))
+    if (e->type == EVENT_CMD_CLOSE)
     {
-        RED_LED_ON();
+        close_attempts_remaining = CLOSE_RETIRES_MAX;
+        return STATE_CLOSE_COMMAND;
     }
-    else
+    if (!DoorIsOpen)
     {
-        RED_LED_OFF();
+        return STATE_WATCH_DOOR;
     }
+    return STATE_IDLE;
+}
+
+void Enter_Wait2Minutes()
+{
+    StatusReport(true);
+    TimerStart(TIMER_AUTO_CLOSE, GARAGE_DOOR_LET_OPEN_TIME);
 }
 
+void Exit_Wait2Minutes()
+{
+    TimerStop(TIMER_AUTO_CLOSE);
+}
 
-void PINK_LED_ON(void)
+E_STATE State_Wait2Minutes(const S_EVENT* e)
 {
-    char t = get_milliseconds_now() % 3;
-    if (t == 0) // 33% of the time
+    if (!DoorIsOpen)
     {
-        RED_LED_ON();
-        BLUE_LED_OFF();
+        return STATE_WATCH_DOOR;
     }
-    else // 67% of the time
+    if (TIMED_OUT(e, TIMER_AUTO_CLOSE) || e->type == EVENT_CMD_CLOSE)
     {
-        RED_LED_OFF();
-        BLUE_LED_ON();
+        close_attempts_remaining = CLOSE_RETIRES_MAX;
+        return STATE_CLOSE_COMMAND;
     }
+    return STATE_WAIT_2_MINUTES;
 }
 
-void PINK_LED_BLINK(void)
+E_STATE State_Close_Command(const S_EVENT* e)
 {
-    char t = get_milliseconds_now() % 100;
-    if (t > 50)
+    if (e->type == EVENT_SENSOR && !e->arg)
     {
-        PINK_LED_ON();
+        CloseLearn(e->ms); // The last attempt's run ended as this one was pressed
     }
-    else
+    if (TIMED_OUT(e, TIMER_RELAY))
     {
-        LED_OFF();
+        return STATE_DOOR_CLOSING;
     }
+    return STATE_CLOSE_COMMAND;
 }
 
-void LedTask(void)
+E_STATE State_Door_Closing(const S_EVENT* e)
 {
-    if (wifiResetInProgress)
+    if (!DoorIsOpen)
     {
-        PINK_LED_BLINK();
+        if (e->type == EVENT_SENSOR)
+        {
+            CloseLearn(e->ms);
+        }
+        return STATE_WATCH_DOOR;
     }
-    else if (state == State_WatchDoor)
+    if (TIMED_OUT(e, TIMER_DOOR_TRAVEL))
     {
-        BLUE_LED_ON();
-        if (Lockdown)
+        TravelMissed(&CloseTravel);
+        if ((close_attempts_remaining-1) > 0) // -1 for the one already happened
         {
-            RED_LED_BLINK();
+            close_attempts_remaining--;
+            EventLogPut(EVENTLOG_CLOSE_RETRY, close_attempts_remaining);
+            return STATE_CLOSE_COMMAND;
         }
         else
         {
-            RED_LED_OFF();
+            return STATE_CLOSE_ERROR;
         }
+        
     }
-    else if (state == State_Wait2Minutes)
-    {
-        BLUE_LED_OFF();
-        RED_LED_ON();
-    }
-    else if (state == State_Door_Closing || state == State_Door_Opening)
+    return STATE_DOOR_CLOSING;
+}
+
+void Enter_CloseError()
+{
+    EventLogPut(EVENTLOG_CLOSE_ERROR, 0);
+}
+
+E_STATE State_CloseError(const S_EVENT* e)
+{
+    if (!DoorIsOpen)
     {
-        RED_LED_OFF();
-        BLUE_LED_BLINK();
+        return STATE_WATCH_DOOR;
     }
-    else if (state == State_CloseError || state == State_OpenError)
+
+    return STATE_CLOSE_ERROR;
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
+void UpdateLeds(void)
+{
+    if (wifiResetInProgress)
     {
-        PINK_LED_ON();
+        LedSetPattern(LED_PINK_BLINK);
     }
-    else if (state == State_Idle)
+    else if (state == STATE_WATCH_DOOR && Config.lockdown)
     {
-        BLUE_LED_OFF();
-        RED_LED_BLINK_SLOW();
+        LedSetPattern(LED_BLUE_RED_BLINK);
     }
     else
     {
-        LED_OFF();
+        LedSetPattern(States[state].led);
     }
 }
 
-void SensorTask(void)
+void Event_ButtonPressedShort()
 {
-    // The sensor doesn't seem to need any debouncing.
-    if (GET_SENSOR()) // == 1 when open
-    {
-        Sensor_closed = false;
-        Sensor_open = true;       
-    }
-    else
-    {
-        Sensor_closed = true;
-        Sensor_open = false;
-    }
+    LockdownCommand(!Config.lockdown);
 }
 
-void Event_ButtonPressedShort()
+void Event_ButtonPressedDouble()
 {
-    Lockdown = !Lockdown;
+    // Close right away, without waiting out the auto-close timer.
+    EventPost(EVENT_CMD_CLOSE, EVENT_SRC_BUTTON, get_milliseconds_now());
 }
 
 void Event_ButtonPressedLong()
 {
     static int pairing_mode = 0;
     WifiReset(pairing_mode);
+    EventLogPut(EVENTLOG_WIFI_RESET, pairing_mode);
     pairing_mode = !pairing_mode;
 }
-
-void ButtonTask(void)
-{
-    #define DEBOUNCE_DELAY_MS 20
-    static int lastDebounceTime = 0;
-    static char last_button_temp_status = 0;
-    static char last_button_status;
-    static uint8_t button_longpress_countdown;
-    static int button_longpress_starttime = 0;
-    bool isStable;
-    bool change;
-
-    enum
-    {
-        BUTTON_DOWN = 0,
-        BUTTON_UP = BUTTON_PIN
-    };
-
-    // read the state of the switch into a local variable:
-    char reading = GET_BUTTON();
-
-    // If the switch changed, due to noise or pressing:
-    if (reading != last_button_temp_status) {
-        // reset the debouncing timer
-        lastDebounceTime = get_milliseconds_now();
-        // save the reading. Next time through the loop, it'll be the lastButtonState:
-        last_button_temp_status = reading;
-        button_longpress_countdown = 0;
-        button_longpress_starttime = get_milliseconds_now();
-    }
-
-    // Button is considered stable if it maintained its status for X ms.
-    isStable = (get_milliseconds_since(lastDebounceTime) > DEBOUNCE_DELAY_MS);
-    if (!isStable) return;
-
-    // determine if the button state has just changed:
-    change = false;
-    if (reading != last_button_status) {
-        last_button_status = reading;
-        change = true;
-    }
-
-    // Button pressed down event:
-    if (change && (last_button_status == BUTTON_DOWN))
-    {
-        Event_ButtonPressedShort();
-    }
-
-    // 
-    if (reading == BUTTON_DOWN)
-    {
-        if (get_milliseconds_since(button_longpress_starttime) > 100)
-        {
-            button_longpress_starttime = get_milliseconds_now();
-            button_longpress_countdown++;
-        }
-
-        if ((last_button_status == BUTTON_DOWN) && (button_longpress_countdown > 30))
-        {
-            button_longpress_countdown = 0;
-            Event_ButtonPressedLong();
-        }
-    }
-}
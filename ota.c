@@ -0,0 +1,46 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include "hal.h"
+#include "ota.h"
+
+bool OtaRequest(uint32_t size)
+{
+    if (size < OTA_IMAGE_MIN || size > OTA_IMAGE_MAX) return false;
+
+    INTERRUPT_DIS(); // For good: the next thing to run is the bootloader
+    OtaRecordStore(OTA_REQUESTED, (uint16_t)size);
+    HalReset();
+    return true;
+}
+
+void OtaRecordLoad(S_OTA_RECORD* record)
+{
+    const uint8_t* p = HAL_EEPROM(OTA_RECORD_OFFSET);
+
+    record->state = p[0];
+    record->size_h = p[1];
+    record->size_l = p[2];
+}
+
+void OtaRecordStore(uint8_t state, uint16_t size)
+{
+    S_OTA_RECORD record;
+
+    record.state = state;
+    record.size_h = size >> 8;
+    record.size_l = size & 0xFF;
+    HalEepromWrite(OTA_RECORD_OFFSET, (const uint8_t*)&record, sizeof(record));
+}
+
+uint16_t OtaCrc16(uint16_t crc, uint8_t b)
+{
+    uint8_t i;
+
+    // Bitwise: a table would cost the bootloader 512 bytes.
+    crc ^= (uint16_t)b << 8;
+    for (i = 0; i < 8; i++)
+    {
+        crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : crc << 1;
+    }
+    return crc;
+}
@@ -0,0 +1,49 @@
+#pragma once
+#include <stdint.h>
+#include <stdbool.h>
+
+// Firmware update over the Tuya UART (MCU upgrade, opcodes 0x0A and 0x0B).
+//
+// Program memory is split between a resident bootloader (boot/) and the
+// application, which the bootloader rewrites in place: 8 KB has no room for
+// a second image. The application only takes the start of an upgrade: it
+// records it in data EEPROM and resets into the bootloader, which answers
+// the module and block-programs each package as it streams in. The image
+// (otaimage.py) ends in a big-endian OtaCrc16() of everything before it,
+// and the bootloader only starts the application once that checks out.
+#define OTA_BOOT_BASE 0x8000
+#define OTA_APP_BASE  0x8800 // The application's vector table
+#define OTA_APP_END   0x9A40 // The block with the stock product key (hal_stm8.h) is never rewritten
+#define OTA_IMAGE_MAX (OTA_APP_END - OTA_APP_BASE)
+#define OTA_IMAGE_MIN 3      // At least one byte and the CRC
+
+#define OTA_PACKAGE_SIZE 256 // What the 0x0A reply asks the module for
+#define OTA_PACKAGE_CODE 0x00
+
+#define OTA_RECORD_OFFSET 0 // In data EEPROM
+
+// Anything but REQUESTED or RECEIVING boots the application, so blank
+// EEPROM does.
+typedef enum
+{
+    OTA_IDLE = 0x00,
+    OTA_REQUESTED = 0x5A, // The application took a 0x0A; the bootloader owes the reply
+    OTA_RECEIVING = 0x3C  // The application region is being rewritten
+} E_OTA_STATE;
+
+typedef struct
+{
+    uint8_t state;
+    uint8_t size_h; // Image size, CRC included
+    uint8_t size_l;
+} S_OTA_RECORD;
+
+// Records the upgrade and resets into the bootloader. Returns false, having
+// done nothing, if an image of this size can't be taken.
+bool OtaRequest(uint32_t size);
+
+void OtaRecordLoad(S_OTA_RECORD* record);
+void OtaRecordStore(uint8_t state, uint16_t size);
+
+// CRC-16/CCITT-FALSE: start from 0xFFFF.
+uint16_t OtaCrc16(uint16_t crc, uint8_t b);
@@ -0,0 +1,66 @@
+#!/usr/bin/env python3
+# Turns the application build into an image for a Tuya MCU upgrade (ota.h).
+#
+#   otaimage.py Release/firmware.s19 garagedoor.bin
+#
+# The image is the application region from OTA_APP_BASE, gaps filled as
+# erased flash, followed by the CRC-16/CCITT-FALSE of all of it, big-endian.
+# Upload it to the Tuya console as the MCU firmware.
+import sys
+
+APP_BASE = 0x8800
+APP_END = 0x9A40
+ERASED = 0x00
+
+
+def load_s19(path):
+    mem = {}
+    with open(path) as f:
+        for line in f:
+            line = line.strip()
+            if len(line) < 4 or line[0] != 'S' or line[1] not in '123':
+                continue
+            addr_len = {'1': 2, '2': 3, '3': 4}[line[1]]
+            raw = bytes.fromhex(line[2:])
+            if sum(raw) & 0xFF != 0xFF:
+                sys.exit('%s: bad checksum: %s' % (path, line))
+            addr = int.from_bytes(raw[1:1 + addr_len], 'big')
+            for i, b in enumerate(raw[1 + addr_len:-1]):
+                mem[addr + i] = b
+    return mem
+
+
+def crc16(data):
+    crc = 0xFFFF
+    for b in data:
+        crc ^= b << 8
+        for _ in range(8):
+            crc = ((crc << 1) ^ 0x1021 if crc & 0x8000 else crc << 1) & 0xFFFF
+    return crc
+
+
+def main():
+    if len(sys.argv) != 3:
+        sys.exit('usage: otaimage.py firmware.s19 image.bin')
+    mem = load_s19(sys.argv[1])
+    outside = [a for a in mem if not APP_BASE <= a < APP_END]
+    if outside:
+        sys.exit('code at 0x%04X, outside the application region: is firmware.stp linked for OTA?'
+                 % min(outside))
+    if not mem:
+        sys.exit('empty image')
+
+    end = max(mem) + 1
+    image = bytes(mem.get(a, ERASED) for a in range(APP_BASE, end))
+    crc = crc16(image)
+    image += bytes([crc >> 8, crc & 0xFF])
+    if len(image) > APP_END - APP_BASE:
+        sys.exit('image is %d bytes, %d fit' % (len(image), APP_END - APP_BASE))
+
+    with open(sys.argv[2], 'wb') as f:
+        f.write(image)
+    print('%s: %d bytes, CRC 0x%04X' % (sys.argv[2], len(image), crc))
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,38 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include "hal.h"
+#include "power.h"
+
+volatile uint8_t PendingWork = 0;
+volatile bool CpuSleeping = false;
+uint32_t ActiveTicks = 0;
+uint32_t SleepTicks = 0;
+
+uint8_t TakeWork(void)
+{
+    uint8_t work;
+
+    INTERRUPT_DIS();
+    work = PendingWork;
+    PendingWork = 0;
+    INTERRUPT_EN();
+    return work;
+}
+
+void SleepUntilWork(void)
+{
+    // WFI re-enables interrupts as it stops the core, so a flag posted after
+    // the check below still wakes us: no lost wakeups. Any interrupt ends the
+    // WFI, the 1 ms tick included, so go straight back to sleep unless the
+    // ISR posted work.
+    // Active-halt isn't an option: it would stop TIM4 and the millisecond clock.
+    INTERRUPT_DIS();
+    while (!PendingWork)
+    {
+        CpuSleeping = true;
+        WAIT_FOR_INTERRUPT(); // Comes back with interrupts enabled
+        CpuSleeping = false;
+        INTERRUPT_DIS();
+    }
+    INTERRUPT_EN();
+}
@@ -0,0 +1,22 @@
+#pragma once
+#include <stdint.h>
+#include <stdbool.h>
+
+// Work flags. ISRs post them, the main loop takes them and runs the matching tasks.
+enum
+{
+    WORK_RX    = 1 << 0, // Bytes waiting in the UART receive ring
+    WORK_TIMER = 1 << 1, // A software timer expired
+    WORK_SENSOR = 1 << 2 // Door sensor edge captured
+};
+
+#define POST_WORK(w) (PendingWork |= (w))
+
+uint8_t TakeWork(void);
+
+void SleepUntilWork(void);
+
+extern volatile uint8_t PendingWork;
+extern volatile bool CpuSleeping;
+extern uint32_t ActiveTicks; // 1 ms ticks that found the CPU running
+extern uint32_t SleepTicks;  // 1 ms ticks that found the CPU in WFI
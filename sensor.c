@@ -0,0 +1,116 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include "hal.h"
+#include "sensor.h"
+#include "time.h"
+#include "power.h"
+
+// Raw edges: filled by ISR_EXTI_PORTC(), drained by SensorPopEdge().
+// Single producer / single consumer, like the UART receive ring.
+#define EDGE_RING_SIZE 8 /* must be a power of 2 */
+#define EDGE_RING_MASK (EDGE_RING_SIZE - 1)
+
+static HAL_NEAR S_SENSOR_EDGE EdgeRing[EDGE_RING_SIZE];
+static volatile uint8_t EdgeHead = 0;
+static volatile uint8_t EdgeTail = 0;
+static volatile bool EdgeResync = false; // Edges were lost; re-read the pin
+
+static bool SensorLevel;                 // Last level handed to the state machine
+#if SENSOR_GLITCH_FILTER_MS > 0
+static S_SENSOR_EDGE FilterEdge;         // Newest edge, waiting to prove it's stable
+static bool FilterPending = false;
+#endif
+
+uint16_t SensorEdgesLost = 0;
+
+void SensorSetup(void)
+{
+    HalSensorIrqSetup();
+    SensorLevel = GET_SENSOR_BOOL(); // == 1 when open
+}
+
+void ISR_EXTI_PORTC(void)
+{
+    uint8_t next = (EdgeHead + 1) & EDGE_RING_MASK;
+
+    if (next == EdgeTail)
+    {
+        SensorEdgesLost++;
+        EdgeResync = true;
+    }
+    else
+    {
+        EdgeRing[EdgeHead].ms = get_milliseconds_now();
+        EdgeRing[EdgeHead].open = GET_SENSOR_BOOL();
+        EdgeHead = next;
+    }
+    POST_WORK(WORK_SENSOR);
+}
+
+static bool PopRawEdge(S_SENSOR_EDGE* edge)
+{
+    if (EdgeTail == EdgeHead)
+    {
+        if (!EdgeResync) return false;
+
+        // The ring overflowed at some point. Whatever the pin says now is the truth.
+        EdgeResync = false;
+        edge->ms = get_milliseconds_now();
+        edge->open = GET_SENSOR_BOOL();
+        return true;
+    }
+    *edge = EdgeRing[EdgeTail];
+    EdgeTail = (EdgeTail + 1) & EDGE_RING_MASK;
+    return true;
+}
+
+static bool Accept(const S_SENSOR_EDGE* candidate, S_SENSOR_EDGE* edge)
+{
+    if (candidate->open == SensorLevel) return false; // A glitch that came back
+    SensorLevel = candidate->open;
+    *edge = *candidate;
+    return true;
+}
+
+bool SensorPopEdge(S_SENSOR_EDGE* edge)
+{
+    S_SENSOR_EDGE raw;
+
+#if SENSOR_GLITCH_FILTER_MS > 0
+    // An edge is only passed on once the line has held its level for
+    // SENSOR_GLITCH_FILTER_MS, either because the next edge came later than
+    // that or because the filter timer ran out first.
+    while (PopRawEdge(&raw))
+    {
+        bool stable = FilterPending &&
+                      (raw.ms - FilterEdge.ms) >= SENSOR_GLITCH_FILTER_MS;
+        S_SENSOR_EDGE settled = FilterEdge;
+        uint32_t age = get_milliseconds_since(raw.ms);
+
+        FilterEdge = raw;
+        FilterPending = true;
+        TimerStart(TIMER_SENSOR_FILTER,
+                   age >= SENSOR_GLITCH_FILTER_MS ? 0 : SENSOR_GLITCH_FILTER_MS - age);
+
+        if (stable && Accept(&settled, edge)) return true;
+    }
+
+    if (FilterPending && TimerExpired(TIMER_SENSOR_FILTER))
+    {
+        FilterPending = false;
+        return Accept(&FilterEdge, edge);
+    }
+    return false;
+#else
+    while (PopRawEdge(&raw))
+    {
+        if (Accept(&raw, edge)) return true;
+    }
+    return false;
+#endif
+}
+
+bool SensorIsOpen(void)
+{
+    return SensorLevel;
+}
@@ -0,0 +1,23 @@
+#pragma once
+#include <stdint.h>
+#include <stdbool.h>
+
+// Reed switches do bounce a little; edges closer together than this are merged.
+// Set to 0 to hand every edge to the state machine as it is captured.
+#define SENSOR_GLITCH_FILTER_MS 10
+
+typedef struct
+{
+    uint32_t ms; // get_milliseconds_now() when the edge was captured
+    bool open;   // Sensor level after the edge
+} S_SENSOR_EDGE;
+
+void SensorSetup(void);
+
+bool SensorPopEdge(S_SENSOR_EDGE* edge);
+
+bool SensorIsOpen(void);
+
+void ISR_EXTI_PORTC(void);
+
+extern uint16_t SensorEdgesLost;
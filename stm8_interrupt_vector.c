@@ -2,6 +2,12 @@
  *	Copyright (c) 2007 STMicroelectronics
  */
 #include "time.h"
+#include "tuya.h"
+#include "sensor.h"
+#include "button.h"
+#include "led.h"
+#include "bench.h"
+#include "latency.h"
 
 typedef void @far (*interrupt_handler_t)(void);
 
@@ -18,9 +24,57 @@ struct interrupt_vector {
 	return;
 }
 
-@far @interrupt void IRQ13 (void)
+@far @interrupt void IRQ5 (void)
 {
-	ISR_TIM2_UPDATEOVERFLOW();
+	HAL_CYCLES_T start = HalCycles();
+
+	BENCH_BEGIN(BENCH_ISR_SENSOR);
+	ISR_EXTI_PORTC();
+	BENCH_END(BENCH_ISR_SENSOR);
+	LatencyIsrDone(LATENCY_ISR_SENSOR, start);
+}
+
+@far @interrupt void IRQ6 (void)
+{
+	HAL_CYCLES_T start = HalCycles();
+
+	BENCH_BEGIN(BENCH_ISR_BUTTON);
+	ISR_EXTI_PORTD();
+	BENCH_END(BENCH_ISR_BUTTON);
+	LatencyIsrDone(LATENCY_ISR_BUTTON, start);
+}
+
+@far @interrupt void IRQ17 (void)
+{
+	HAL_CYCLES_T start = HalCycles();
+
+	BENCH_BEGIN(BENCH_ISR_UART_TX);
+	ISR_UART1_TX();
+	BENCH_END(BENCH_ISR_UART_TX);
+	LatencyIsrDone(LATENCY_ISR_UART_TX, start);
+}
+
+@far @interrupt void IRQ18 (void)
+{
+	HAL_CYCLES_T start = HalCycles();
+
+	BENCH_BEGIN(BENCH_ISR_UART_RX);
+	ISR_UART1_RX();
+	BENCH_END(BENCH_ISR_UART_RX);
+	LatencyIsrDone(LATENCY_ISR_UART_RX, start);
+}
+
+@far @interrupt void IRQ23 (void)
+{
+	HAL_CYCLES_T start = HalCycles();
+
+	BENCH_BEGIN(BENCH_ISR_TICK);
+	ISR_TIM4_UPDATE();
+	BENCH_END(BENCH_ISR_TICK);
+	BENCH_BEGIN(BENCH_LED_TICK);
+	LedTick();
+	BENCH_END(BENCH_LED_TICK);
+	LatencyIsrDone(LATENCY_ISR_TICK, start);
 }
 
 extern void _stext();     /* startup routine */
@@ -34,25 +88,25 @@ struct interrupt_vector const _vectab[] = {
 	{0x82, NonHandledInterrupt}, /* irq2  */
 	{0x82, NonHandledInterrupt}, /* irq3  */
 	{0x82, NonHandledInterrupt}, /* irq4  */
-	{0x82, NonHandledInterrupt}, /* irq5  */
-	{0x82, NonHandledInterrupt}, /* irq6  */
+	{0x82, IRQ5}, /* irq5  */
+	{0x82, IRQ6}, /* irq6  */
 	{0x82, NonHandledInterrupt}, /* irq7  */
 	{0x82, NonHandledInterrupt}, /* irq8  */
 	{0x82, NonHandledInterrupt}, /* irq9  */
 	{0x82, NonHandledInterrupt}, /* irq10 */
 	{0x82, NonHandledInterrupt}, /* irq11 */
 	{0x82, NonHandledInterrupt}, /* irq12 */
-	{0x82, IRQ13}, /* irq13 */
-	{0x82, IRQ13}, /* irq14 */
+	{0x82, NonHandledInterrupt}, /* irq13 */
+	{0x82, NonHandledInterrupt}, /* irq14 */
 	{0x82, NonHandledInterrupt}, /* irq15 */
 	{0x82, NonHandledInterrupt}, /* irq16 */
-	{0x82, NonHandledInterrupt}, /* irq17 */
-	{0x82, NonHandledInterrupt}, /* irq18 */
+	{0x82, IRQ17}, /* irq17 */
+	{0x82, IRQ18}, /* irq18 */
 	{0x82, NonHandledInterrupt}, /* irq19 */
 	{0x82, NonHandledInterrupt}, /* irq20 */
 	{0x82, NonHandledInterrupt}, /* irq21 */
 	{0x82, NonHandledInterrupt}, /* irq22 */
-	{0x82, NonHandledInterrupt}, /* irq23 */
+	{0x82, IRQ23}, /* irq23 */
 	{0x82, NonHandledInterrupt}, /* irq24 */
 	{0x82, NonHandledInterrupt}, /* irq25 */
 	{0x82, NonHandledInterrupt}, /* irq26 */
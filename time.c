@@ -1,99 +1,185 @@
-#include <iostm8s003.h>
 #include <stdint.h>
 #include <stdbool.h>
+#include "hal.h"
+#include "time.h"
+#include "power.h"
+#include "event.h"
 
-#define TIM1_AUTO_RELOAD 1000
-#define TIM1_PRESCALER 2000
-
-static bool Time_passed;
-
-enum {
-    BIT_0 = 1 << 0,
-    BIT_1 = 1 << 1,
-    BIT_2 = 1 << 2,
-    BIT_3 = 1 << 3,
-    BIT_4 = 1 << 4,
-    BIT_5 = 1 << 5,
-    BIT_6 = 1 << 6,
-    BIT_7 = 1 << 7
-};
-
-enum {
-    TIM2_CR1_ENABLE = BIT_0,
-    TIM2_CR1_AUTORELOAD = BIT_7,
-    TIM2_CCMR_OUTPUT_TOGGLE_MODE = BIT_5 | BIT_4,
-    TIM2_CCER1_CC2E = BIT_4,
-    TIM2_IER_CC1IE = BIT_1,
-    TIM2_IER_UIE = BIT_0,
-    TIM2_EGR_UG = BIT_0,
-    TIM_PRESCALER_16384 = 0xE,
-//    TIM_PRESCALER_8192 = 0xD,
-//    TIM_PRESCALER_4096 = 0xC,
-    TIM_PRESCALER_2048 = 0xB
-//    TIM_PRESCALER_1024 = 0xA
-};
+#define TIMER_NONE 0xFF
 
+static volatile uint32_t Milliseconds; // Incremented by ISR_TIM4_UPDATE() only
+
+// Software timers. Armed timers are kept on a list sorted by deadline, so the
+// tick ISR only ever compares against TimerHead, the nearest one. The list is
+// edited with interrupts off since the ISR pops from its head.
+static uint32_t TimerDeadline[TIMER_COUNT];
+static uint8_t TimerNext[TIMER_COUNT];
+static uint8_t TimerHead = TIMER_NONE;
+static uint8_t TimerArmed = 0;            // One bit per timer on the list
+static volatile uint8_t TimerFired = 0;   // One bit per timer that expired
+static uint8_t TimerGen[TIMER_COUNT];     // Bumped on every start and stop
 
 void TimersSetup(void)
 {
-    TIM2_ARRH = 0xFF;
-    TIM2_ARRL = 0xFF;
-
-    TIM1_ARRH = TIM1_AUTO_RELOAD >> 8;
-    TIM1_ARRL = TIM1_AUTO_RELOAD & 0xFF;
-    TIM1_PSCRH = TIM1_PRESCALER >> 8;
-    TIM1_PSCRL = TIM1_PRESCALER & 0xFF;
-    TIM1_EGR = TIM2_EGR_UG; // Reset timer, clear all the things, and apply the prescaler.
-    TIM1_CR1 = TIM2_CR1_ENABLE | TIM2_CR1_AUTORELOAD; // Enable the timer
+    // TIM4 is the 1 ms system tick, TIM1 counts cycles for latency.h.
+    HalTickSetup();
+    HalCyclesSetup();
+}
+
+void ISR_TIM4_UPDATE(void)
+{
+    HAL_TICK_ACK();
+    Milliseconds++;
+
+    // Sample where the CPU is each tick, for a cheap duty-cycle figure.
+    if (CpuSleeping)
+    {
+        SleepTicks++;
+    }
+    else
+    {
+        ActiveTicks++;
+    }
+
+    while (TimerHead != TIMER_NONE &&
+           (int32_t)(Milliseconds - TimerDeadline[TimerHead]) >= 0)
+    {
+        // An expiry the event queue can't take is kept as its TimerFired
+        // bit, for TimerPopMissed(): the state machine must never lose one.
+        if (!(TIMER_EVENTS & TIMER_BIT(TimerHead)) ||
+            !EventPostFromISR(EVENT_TIMER, TimerHead, TimerGen[TimerHead], Milliseconds))
+        {
+            TimerFired |= TIMER_BIT(TimerHead);
+        }
+        POST_WORK(WORK_TIMER);
+        TimerArmed &= ~TIMER_BIT(TimerHead);
+        TimerHead = TimerNext[TimerHead];
+    }
 }
 
-bool IsTimePassed(void)
+static void TimerUnlink(uint8_t timer)
 {
-    if (Time_passed)
+    uint8_t* link = &TimerHead;
+
+    if (!(TimerArmed & TIMER_BIT(timer))) return;
+
+    while (*link != timer)
     {
-        Time_passed = false;
-        return true;
+        link = &TimerNext[*link];
     }
-    return false;
+    *link = TimerNext[timer];
+    TimerArmed &= ~TIMER_BIT(timer);
 }
 
-void ISR_TIM2_UPDATEOVERFLOW(void)
+void TimerStartFromISR(uint8_t timer, uint32_t ms_in_future)
 {
-    Time_passed = true;
-    TIM2_SR1 = 0; // ACK the event
-    TIM2_CR1 = 0; // Disable the timer
+    // Interrupts are already masked in here, and must stay that way.
+    uint8_t* link = &TimerHead;
+    uint32_t deadline;
+
+    TimerUnlink(timer);
+    TimerFired &= ~TIMER_BIT(timer); // Disable a would-be pending event
+    TimerGen[timer]++;               // and make a queued one stale
+
+    deadline = Milliseconds + ms_in_future;
+    TimerDeadline[timer] = deadline;
+    while (*link != TIMER_NONE && (int32_t)(TimerDeadline[*link] - deadline) <= 0)
+    {
+        link = &TimerNext[*link];
+    }
+    TimerNext[timer] = *link;
+    *link = timer;
+    TimerArmed |= TIMER_BIT(timer);
 }
 
-void SetNotification(int seconds_in_future)
+void TimerStart(uint8_t timer, uint32_t ms_in_future)
 {
-    uint16_t ticks = (seconds_in_future * 122); // (roughly)
-    if (ticks <= 0) ticks = 1;
-    TIM2_CR1 = 0; // Disable the timer
-    TIM2_PSCR = TIM_PRESCALER_16384;
-    TIM2_CCR1H = ticks >> 8;
-    TIM2_CCR1L = ticks & 0xFF;
-    TIM2_CNTRH = 0;
-    TIM2_CNTRL = 0;
-    TIM2_IER = TIM2_IER_CC1IE; // Enable the timer interrupt
-    TIM2_EGR = TIM2_EGR_UG; // Reset timer, clear all the things, and apply the prescaler.
-    Time_passed = false; // Disable a would-be pending event
-    TIM2_CR1 = TIM2_CR1_ENABLE; // Enable the timer
+    INTERRUPT_DIS();
+    TimerStartFromISR(timer, ms_in_future);
+    INTERRUPT_EN();
 }
 
-int get_milliseconds_now(void)
+void TimerStop(uint8_t timer)
 {
-    // ! must be read in this order!
-    uint8_t a = TIM1_CNTRH;
-    uint8_t b = TIM1_CNTRL;
-    
-    uint16_t val = (a << 8) | b;
+    INTERRUPT_DIS();
+    TimerUnlink(timer);
+    TimerFired &= ~TIMER_BIT(timer);
+    TimerGen[timer]++;
+    INTERRUPT_EN();
 }
 
-int get_milliseconds_since(int when)
+bool TimerExpired(uint8_t timer)
 {
-    int now = get_milliseconds_now();
+    bool fired = false;
+
+    INTERRUPT_DIS();
+    if (TimerFired & TIMER_BIT(timer))
+    {
+        TimerFired &= ~TIMER_BIT(timer);
+        fired = true;
+    }
+    INTERRUPT_EN();
+    return fired;
+}
 
-    int diff = now - when;
-    if (diff < 0) diff += TIM1_AUTO_RELOAD;
-    return diff;
+bool TimerPopMissed(S_EVENT* e)
+{
+    uint8_t timer;
+    bool fired = false;
+
+    INTERRUPT_DIS();
+    for (timer = 0; timer < TIMER_COUNT; timer++)
+    {
+        if (TimerFired & TIMER_EVENTS & TIMER_BIT(timer))
+        {
+            TimerFired &= ~TIMER_BIT(timer);
+            e->ms = Milliseconds;
+            e->type = EVENT_TIMER;
+            e->arg = timer;
+            e->seq = TimerGen[timer];
+            fired = true;
+            break;
+        }
+    }
+    INTERRUPT_EN();
+    return fired;
+}
+
+uint8_t TimerGeneration(uint8_t timer)
+{
+    // A single byte, only written with interrupts masked.
+    return TimerGen[timer];
+}
+
+#ifdef HAL_HOST
+uint32_t TimerIdleFor(void)
+{
+    int32_t left;
+
+    if (TimerHead == TIMER_NONE) return TIMER_IDLE_FOREVER;
+    left = (int32_t)(TimerDeadline[TimerHead] - Milliseconds);
+    return left > 0 ? (uint32_t)left : 0;
+}
+
+void TimeSkip(uint32_t ms)
+{
+    Milliseconds += ms;
+}
+#endif
+
+uint32_t get_milliseconds_now(void)
+{
+    // A 32-bit read isn't atomic on this core. Re-read until no tick landed in between.
+    uint32_t now;
+    do
+    {
+        now = Milliseconds;
+    } while (now != Milliseconds);
+    return now;
+}
+
+uint32_t get_milliseconds_since(uint32_t when)
+{
+    // Unsigned subtraction stays correct across the 49-day wrap.
+    return get_milliseconds_now() - when;
 }
@@ -1,14 +1,59 @@
 #pragma once
+#include <stdint.h>
 #include <stdbool.h>
+#include "event.h"
+
+// Software timer handles. Each one is an independent one-shot.
+// One bit each in an 8-bit mask, so there can be at most 8.
+enum
+{
+    TIMER_RELAY,
+    TIMER_DOOR_TRAVEL,
+    TIMER_AUTO_CLOSE,
+    TIMER_SENSOR_FILTER,
+    TIMER_BUTTON_DEBOUNCE,
+    TIMER_BUTTON_GESTURE,
+    TIMER_EEPROM,         // Wakes the loop for the next EEPROM word
+    TIMER_COUNT
+};
+
+#define TIMER_BIT(t) ((uint8_t)(1 << (t)))
+
+// Timers the state machine waits on. Their expiry is posted to the event
+// queue as EVENT_TIMER instead of being polled with TimerExpired().
+#define TIMER_EVENTS (TIMER_BIT(TIMER_RELAY) | TIMER_BIT(TIMER_DOOR_TRAVEL) | \
+                      TIMER_BIT(TIMER_AUTO_CLOSE))
 
 void TimersSetup(void);
 
-bool IsTimePassed(void);
+void TimerStart(uint8_t timer, uint32_t ms_in_future);
+
+void TimerStartFromISR(uint8_t timer, uint32_t ms_in_future);
+
+void TimerStop(uint8_t timer);
+
+bool TimerExpired(uint8_t timer);
+
+// A TIMER_EVENTS expiry the event queue was too full to take, as the
+// EVENT_TIMER it would have been; the main loop drains these after the queue.
+bool TimerPopMissed(S_EVENT* e);
+
+// An EVENT_TIMER is stale if its seq no longer matches: the timer has been
+// stopped or restarted since it fired.
+uint8_t TimerGeneration(uint8_t timer);
 
-void SetNotification(int seconds_in_future);
+uint32_t get_milliseconds_now(void);
 
-int get_milliseconds_now(void);
+uint32_t get_milliseconds_since(uint32_t when);
 
-int get_milliseconds_since(int when);
+void ISR_TIM4_UPDATE(void);
 
-void ISR_TIM2_UPDATEOVERFLOW(void);
+#ifdef HAL_HOST
+// Virtual time, for the host simulator. TimerIdleFor() is how many ms until
+// the nearest armed timer is due. TimeSkip() moves the clock on without
+// ticking; it must stop short of that deadline, so the tick that follows
+// fires it as usual.
+#define TIMER_IDLE_FOREVER 0xFFFFFFFFUL
+uint32_t TimerIdleFor(void);
+void TimeSkip(uint32_t ms);
+#endif
@@ -0,0 +1,35 @@
+#include <stdint.h>
+#include "hal.h"
+#include "trace.h"
+#include "time.h"
+
+#ifdef TRACE
+#define TRACE_MASK (TRACE_RECORDS - 1)
+
+HAL_NEAR S_TRACE Trace = { TRACE_MAGIC, TRACE_RECORDS, 0, 0, 0 };
+
+static void Put(uint8_t type, uint8_t data, uint8_t len, uint8_t sum)
+{
+    S_TRACE_RECORD* r = &Trace.ring[Trace.head];
+    uint16_t ms = (uint16_t)get_milliseconds_now();
+
+    r->type = type;
+    r->data = data;
+    r->len = len;
+    r->sum = sum;
+    r->ms_h = ms >> 8;
+    r->ms_l = ms & 0xFF;
+    Trace.head = (Trace.head + 1) & TRACE_MASK;
+    if (Trace.head == 0) Trace.wrapped = 1;
+}
+
+void TracePut(uint8_t type, uint8_t data)
+{
+    Put(type, data, 0, 0);
+}
+
+void TraceFrame(uint8_t type, uint8_t opcode, uint16_t len, uint8_t sum)
+{
+    Put(type, opcode, len > 0xFF ? 0xFF : (uint8_t)len, sum);
+}
+#endif
@@ -0,0 +1,60 @@
+#pragma once
+#include <stdint.h>
+#include "hal.h"
+
+// Protocol trace: the last TRACE_RECORDS UART frames, events and state
+// changes, with the low 16 bits of the millisecond clock. A frame is one
+// record, opcode, length and checksum, not one per byte: 16 of them hold a
+// few heartbeats as well as a query and its answer. Only built in with TRACE
+// defined, as the host build does: otherwise TracePut() and TraceFrame() are
+// no-ops and the image is unchanged. To read it, dump RAM in one SWIM read and
+// run tracedump.py, which finds the block by its magic. Costs 6 bytes of RAM
+// per record, plus 8.
+//
+// The layout is bytes only, so it reads the same from any dump.
+#ifndef TRACE_RECORDS
+#define TRACE_RECORDS 16 /* must be a power of 2, at most 128 */
+#endif
+#define TRACE_MAGIC "TRC2"
+
+typedef enum
+{
+    TRACE_NONE,     // Slot never written
+    TRACE_RX_FRAME, // Frame received, as it's processed
+    TRACE_RX_BAD,   // Frame dropped on its checksum: sum as received
+    TRACE_TX_FRAME, // Frame queued to send
+    TRACE_TX_DROP,  // Frame the TX ring had no room for
+    TRACE_EVENT,    // data: E_EVENT << 4 | arg
+    TRACE_STATE     // data: state entered
+} E_TRACE;
+
+typedef struct
+{
+    uint8_t type; // E_TRACE
+    uint8_t data; // Frames: opcode
+    uint8_t len;  // Frames: payload length, 255 if longer
+    uint8_t sum;  // Frames: checksum byte
+    uint8_t ms_h;
+    uint8_t ms_l;
+} S_TRACE_RECORD;
+
+typedef struct
+{
+    char magic[4];
+    uint8_t records; // TRACE_RECORDS
+    uint8_t head;    // Slot written next; the oldest record once it has wrapped
+    uint8_t wrapped;
+    uint8_t spare;   // Keeps the ring 4-aligned
+    S_TRACE_RECORD ring[TRACE_RECORDS];
+} S_TRACE;
+
+#ifdef TRACE
+void TracePut(uint8_t type, uint8_t data);
+
+void TraceFrame(uint8_t type, uint8_t opcode, uint16_t len, uint8_t sum);
+
+extern HAL_NEAR S_TRACE Trace;
+#else
+#define TracePut(type, data)                 ((void)0)
+#define TraceFrame(type, opcode, len, sum)   ((void)0)
+#endif
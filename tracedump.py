@@ -0,0 +1,111 @@
+#!/usr/bin/env python3
+# Decodes the firmware's protocol trace (trace.h): Tuya frames by name, events and states.
+#
+#   tracedump.py              Read the board's RAM over SWIM with stm8flash, then decode
+#   tracedump.py ram.bin      Decode a dump: the board's RAM, or the file the host
+#                             build writes when GARAGEDOOR_TRACE is set
+#
+# The trace is found by its magic, so any dump that contains the block works.
+import os
+import subprocess
+import sys
+import tempfile
+
+MAGIC = b'TRC2'
+HEADER_LEN = 8
+RECORD_LEN = 6
+
+STM8FLASH = ['stm8flash', '-c', 'stlinkv2', '-p', 'stm8s003?3', '-s', 'ram']
+
+# trace.h E_TRACE
+TRACE_NONE, TRACE_RX_FRAME, TRACE_RX_BAD, TRACE_TX_FRAME, TRACE_TX_DROP, \
+    TRACE_EVENT, TRACE_STATE = range(7)
+
+OPCODES = {
+    0x00: 'heartbeat',
+    0x01: 'product info',
+    0x02: 'query mcu',
+    0x03: 'network status',
+    0x04: 'reset wifi',
+    0x05: 'pairing mode',
+    0x06: 'command',
+    0x07: 'status',
+    0x08: 'query status',
+    0x0A: 'upgrade start',
+    0x0B: 'upgrade package',
+}
+
+# event.h E_EVENT, and main.c E_STATE
+EVENTS = ['none', 'cmd open', 'cmd close', 'sensor', 'button', 'timer']
+STATES = ['WATCH_DOOR', 'WAIT_2_MINUTES', 'OPEN_COMMAND', 'DOOR_OPENING', 'OPEN_ERROR',
+          'IDLE', 'CLOSE_COMMAND', 'DOOR_CLOSING', 'CLOSE_ERROR']
+
+
+def read_board():
+    with tempfile.TemporaryDirectory() as tmp:
+        path = os.path.join(tmp, 'ram.bin')
+        subprocess.run(STM8FLASH + ['-r', path], check=True)
+        with open(path, 'rb') as f:
+            return f.read()
+
+
+def records(dump):
+    at = dump.find(MAGIC)
+    if at < 0:
+        sys.exit('no trace block in the dump')
+    count, head, wrapped = dump[at + 4], dump[at + 5], dump[at + 6]
+    ring = dump[at + HEADER_LEN:at + HEADER_LEN + count * RECORD_LEN]
+    if len(ring) < count * RECORD_LEN:
+        sys.exit('dump ends inside the trace block')
+    order = list(range(head, count)) + list(range(head)) if wrapped else range(head)
+    for i in order:
+        r = ring[i * RECORD_LEN:(i + 1) * RECORD_LEN]
+        yield r[0], r[1], r[2], r[3], (r[4] << 8) | r[5]
+
+
+def frame(opcode, length, checksum):
+    name = OPCODES.get(opcode, 'opcode 0x%02X' % opcode)
+    return '%-16s %s bytes, sum %02X' % (name, '255+' if length == 0xFF else length, checksum)
+
+
+def decode(dump):
+    t = None
+    last = 0
+
+    for kind, data, length, checksum, ms in records(dump):
+        if kind == TRACE_NONE:
+            continue
+        # 16-bit stamps: assume no two records are more than a minute apart.
+        t = 0 if t is None else t + ((ms - last) & 0xFFFF)
+        last = ms
+
+        if kind == TRACE_RX_FRAME:
+            line = 'RX  ' + frame(data, length, checksum)
+        elif kind == TRACE_RX_BAD:
+            line = 'RX  ' + frame(data, length, checksum) + '  [bad checksum, dropped]'
+        elif kind == TRACE_TX_FRAME:
+            line = 'TX  ' + frame(data, length, checksum)
+        elif kind == TRACE_TX_DROP:
+            line = 'TX  ' + frame(data, length, checksum) + '  [TX ring full, dropped]'
+        elif kind == TRACE_EVENT:
+            event = data >> 4
+            line = '    event %s %d' % (EVENTS[event] if event < len(EVENTS) else event, data & 0x0F)
+        elif kind == TRACE_STATE:
+            line = '    state -> %s' % (STATES[data] if data < len(STATES) else data)
+        else:
+            line = '    record type %d data 0x%02X' % (kind, data)
+
+        print('%9.3f  %s' % (t / 1000.0, line))
+
+
+def main():
+    if len(sys.argv) > 1:
+        with open(sys.argv[1], 'rb') as f:
+            dump = f.read()
+    else:
+        dump = read_board()
+    decode(dump)
+
+
+if __name__ == '__main__':
+    main()
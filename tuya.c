@@ -1,7 +1,17 @@
 #include <stdint.h>
 #include <stdbool.h>
-#include <iostm8s003.h>
+#include "hal.h"
 #include "tuya.h"
+#include "datapoints.h"
+#include "power.h"
+#include "time.h"
+#include "event.h"
+#include "bench.h"
+#include "latency.h"
+#include "trace.h"
+#include "ota.h"
+#include "eventlog.h"
+#include "config.h"
 
 enum TUYA_STUFF {
     TUYA_HEADER_1 = 0x55,
@@ -9,10 +19,22 @@ enum TUYA_STUFF {
     TUYA_VERSION = 0x03
 };
 
-enum {
-    UART1_SR_RXNE = (1<<5),
-    UART1_SR_TXE  = (1<<7)
-};
+// Receive ring: filled by ISR_UART1_RX(), drained by RxTask().
+// Single producer / single consumer, so only the ISR writes RxHead and only
+// RxTask() writes RxTail. 8-bit indices are read and written atomically.
+// Frames are parsed in place: RxTail stays on the first byte of the frame
+// being assembled until it has been processed, so Process() reads the
+// payload straight out of the ring. That also caps the largest frame that
+// can be held at RX_RING_SIZE - 1 bytes.
+#define RX_RING_SIZE 128 /* must be a power of 2 */
+#define RX_RING_MASK (RX_RING_SIZE - 1)
+
+// Transmit ring: filled a whole frame at a time by TxFrameBegin()/Tx()/TxFrameEnd(),
+// drained by ISR_UART1_TX(). Bytes of a frame under construction are written
+// past TxHead and only become visible to the ISR when TxFrameEnd() publishes
+// them, so the ISR never sends half a frame.
+#define TX_RING_SIZE 64 /* must be a power of 2 */
+#define TX_RING_MASK (TX_RING_SIZE - 1)
 
 enum
 {
@@ -24,104 +46,317 @@ enum
     OPCODE_SET_PAIRING_MODE = 0x05,
     OPCODE_COMMAND = 0x06,
     OPCODE_STATUS = 0x07,
-    OPCODE_QUERY_STATUS = 0x08
+    OPCODE_QUERY_STATUS = 0x08,
+    OPCODE_UPGRADE_START = 0x0A // Payload: image size, 4 bytes big-endian
 };
 
+// Datapoint types
 enum
 {
+    TUYA_TYPE_RAW = 0x00,
     TUYA_TYPE_BOOL = 0x01,
-    TUYA_TYPE_UINT32 = 0x02
+    TUYA_TYPE_UINT32 = 0x02, // "value": 4 bytes, big-endian
+    TUYA_TYPE_STRING = 0x03,
+    TUYA_TYPE_ENUM = 0x04,
+    TUYA_TYPE_BITMAP = 0x05
 };
 
-typedef struct 
+// bench.h probe for a frame handler, by opcode
+#define FRAME_PROBE(opcode) \
+    ((opcode) <= OPCODE_QUERY_STATUS ? BENCH_FRAME + (opcode) : BENCH_FRAME_OTHER)
+
+#define TUYA_DP_HEADER_LEN 4 // dpid, type, len_h, len_l
+
+#define DP_INDEX(name, dpid, type, flags, min, max, var, on_write) DP_##name,
+#define DP_ID(name, dpid, type, flags, min, max, var, on_write) DPID_##name = (dpid),
+
+enum { TUYA_DATAPOINTS(DP_INDEX) DP_COUNT };
+enum { TUYA_DATAPOINTS(DP_ID) };
+
+#define DP_BIT(dp) ((uint16_t)1 << (dp))
+
+// A schema row, as it sits in flash.
+typedef struct
 {
-    uint8_t dpid; // datapoint id.
-    uint8_t type; // type: type=1 for bool
-    uint8_t len_h; // always 0
-    uint8_t len_l; // always 1
-    uint8_t value; // Value of the door sensor. 1 = open/opening, 0 = closed.
-} S_TUYA_DATA_BOOL;
+    uint8_t dpid;
+    uint8_t type;
+    uint8_t flags;
+    uint8_t size; // sizeof the backing variable
+    uint32_t min;
+    uint32_t max;
+    void* var;
+    void (*on_write)(uint32_t value);
+} S_DP_DEF;
+
+// A received frame, as a view into the receive ring. Use FrameByte() to read
+// the payload, since it may wrap around the end of the ring.
+typedef struct
+{
+    uint8_t opcode;
+    uint16_t len;  // Payload length
+    uint8_t start; // Ring index of the first payload byte
+} S_TUYA_FRAME;
 
-typedef struct 
+// One datapoint of a received frame. Its value is at payload offset 'at'.
+typedef struct
 {
-    uint8_t dpid; // datapoint id.
-    uint8_t type; // type 2 for uint32_t
-    uint8_t len_h; // always 0
-    uint8_t len_l; // always 4
-    uint32_t value; // Value (of what??)
-} S_TUYA_DATA_UINT32;
+    uint8_t dpid;
+    uint8_t type;
+    uint16_t len;
+    uint16_t at;
+} S_TUYA_DP;
+
+//////////////////////////////////////////////////////////////////////
+// Frame catalogue. Every reply that never changes lives here in flash with its
+// checksum folded in by the compiler, so sending it is a single TxFrame().
+
+#define TUYA_FRAME_HEADER_LEN 6
+#define TUYA_RX_VERSION 0x00 // The module sends version 0, not TUYA_VERSION
+
+// Frames that fit in the receive ring are handed to Process(). The module
+// sends nothing longer to the application (upgrade packages go to the
+// bootloader, ota.h), so a longer length can only come from a false header,
+// and the scan resyncs. The module sends a frame back to back; after a pause
+// of RX_GAP_MS, a frame begun before it can't be completed by what follows,
+// so it's given up on the same way.
+#define RX_FRAME_MAX (RX_RING_SIZE - 1)
+#define RX_GAP_MS 20 // Over 19 byte times at 9600 baud
+#define TUYA_CSUM_BASE (TUYA_HEADER_1 + TUYA_HEADER_2 + TUYA_VERSION)
+
+#define TUYA_FRAME_0(op) \
+    { TUYA_HEADER_1, TUYA_HEADER_2, TUYA_VERSION, (op), 0, 0, \
+      (uint8_t)(TUYA_CSUM_BASE + (op)) }
+
+#define TUYA_FRAME_1(op, b) \
+    { TUYA_HEADER_1, TUYA_HEADER_2, TUYA_VERSION, (op), 0, 1, (b), \
+      (uint8_t)(TUYA_CSUM_BASE + (op) + 1 + (b)) }
+
+static const uint8_t HeartbeatFrame[2][8] = {
+    TUYA_FRAME_1(OPCODE_HEARTBEAT, 0), // First heartbeat after boot
+    TUYA_FRAME_1(OPCODE_HEARTBEAT, 1)
+};
+// 0x0000 = module self-processing mode. (i.e. tuya has no reset pin connected to its GPIO)
+static const uint8_t QueryMcuFrame[7] = TUYA_FRAME_0(OPCODE_QUERY_MCU);
+static const uint8_t ReportModeAckFrame[7] = TUYA_FRAME_0(OPCODE_REPORT_NETWORK_STATUS);
+static const uint8_t WifiResetFrame[7] = TUYA_FRAME_0(OPCODE_RESET_WIFI);
+static const uint8_t PairingModeFrame[2][8] = {
+    TUYA_FRAME_1(OPCODE_SET_PAIRING_MODE, 0),
+    TUYA_FRAME_1(OPCODE_SET_PAIRING_MODE, 1)
+};
+
+// The product info frame embeds the key that the stock firmware left in flash,
+// so it's assembled once at boot. Sample payload:
+// {"p":"REDACTEDREDACTED","v":"1.0.0","m":0}
+#define PRODUCT_KEY_MAX 16
+#define PRODUCT_INFO_HEAD "{\"p\":\""
+#define PRODUCT_INFO_TAIL "\",\"v\":\"" TUYA_PRODUCT_VERSION "\",\"m\":" TUYA_PRODUCT_MODE "}"
+#define PRODUCT_INFO_FRAME_MAX (TUYA_FRAME_HEADER_LEN + (sizeof(PRODUCT_INFO_HEAD) - 1) + \
+                                PRODUCT_KEY_MAX + (sizeof(PRODUCT_INFO_TAIL) - 1) + 1)
+
+static HAL_NEAR uint8_t ProductInfoFrame[PRODUCT_INFO_FRAME_MAX];
+static uint8_t ProductInfoFrameLen = 0;
+
+//////////////////////////////////////////////////////////////////////
 
 static uint8_t ChksumByte = 0;
-static uint8_t TxBufferLen = 0;
-static uint8_t TxBuffer[70];
 static uint8_t first_heartbeat = 0;
-static uint8_t lastKnownDoorState = 0;
 static uint8_t pairingMode = 0;
 
+static HAL_NEAR volatile uint8_t RxRing[RX_RING_SIZE];
+static volatile uint8_t RxHead = 0;
+static volatile uint8_t RxTail = 0;
+static uint16_t RxLastMs = 0;       // When the ISR took the last byte
+static volatile bool RxGap = false; // Set with RxGapAt, taken by RxTask()
+static volatile uint8_t RxGapAt;    // Ring index of the first byte after a pause
+
+static HAL_NEAR volatile uint8_t TxRing[TX_RING_SIZE];
+static volatile uint8_t TxHead = 0;
+static volatile uint8_t TxTail = 0;
+static uint8_t TxPending = 0;   // TxHead of the frame under construction
+static uint8_t TxOpcode;        // Its opcode, for the trace
+static uint8_t TxLenAt;         // Ring index of its length field
+static uint16_t TxLen;          // Payload bytes written so far
+static bool TxOverflow = false; // The frame under construction didn't fit
+
 bool wifiResetInProgress = 0;
+uint16_t TxDroppedFrames = 0; // Frames refused because the TX ring was full
+// Datapoint backing variables
+static bool DoorOpen = false;
+static uint32_t StockEx = 0;
+
+// Link health and store-and-forward. The module heartbeats every 15 s once
+// it has had a reply, and reports its network status whenever that changes;
+// until it has, the cloud is taken to be reachable. Door states that can't go
+// out are held in LinkQueue, oldest first, and replayed as one status frame
+// once the link is back. Consecutive entries always differ.
+#define LINK_HEARTBEAT_TIMEOUT_MS 40000UL // Two missed heartbeats, with some slack
+#define LINK_QUEUE_MAX 4                  // 47-byte replay frame: fits the TX ring
+#define NET_STATUS_CLOUD 0x04             // Connected to the cloud
+#define NET_STATUS_UNKNOWN 0xFF
+static uint8_t NetStatus = NET_STATUS_UNKNOWN;
+static uint32_t LastHeartbeat = 0;
+static uint8_t LinkQueue[LINK_QUEUE_MAX];
+static uint8_t LinkQueued = 0;
+static uint8_t LinkSent = 0xFF; // Door state the cloud last got, 0xFF if none
+
+uint16_t RxBadFrames = 0;     // Frames dropped on a checksum mismatch
+uint16_t RxUnknownFrames = 0; // Frames with an opcode Process() doesn't handle
+uint8_t RxUnknownOpcode = 0;  // The last such opcode
 
 //////////////////////////////////////////////////////////////////////
 
 static void Tx(uint8_t byte);
-static void TxChksum(void);
-static void TxBytes(uint8_t* buffer, uint8_t len);
-static void TxCString(char* buffer);
+static void TxFrameBegin(uint8_t opcode);
+static bool TxFrameEnd(void);
+static void TxBytes(const uint8_t* buffer, uint8_t len);
+static void TxDpHeader(uint8_t dpid, uint8_t type, uint8_t len);
+static void TxDp(const S_DP_DEF* def);
+static bool ReportDps(uint16_t mask);
+static bool LinkUp(void);
+static void LinkHold(uint8_t open);
+static void LinkFlush(void);
+static bool TxFrame(const uint8_t* frame, uint8_t len);
+static void BuildProductInfoFrame(void);
 static void HeartBeat(void);
 static void QueryProductInfo(void);
 static void QueryMCU(void);
 static void ReportModeAck(void);
-static void Process(uint8_t opcode, uint8_t *data);
-static void StatusReport_Ex(void);
+static uint8_t FrameByte(const S_TUYA_FRAME* f, uint16_t i);
+static void Process(const S_TUYA_FRAME* f);
+static bool DpNext(const S_TUYA_FRAME* f, uint16_t* pos, S_TUYA_DP* dp);
+static uint32_t DpValue(const S_TUYA_FRAME* f, const S_TUYA_DP* dp);
+static const S_DP_DEF* DpFind(uint8_t dpid);
+static uint32_t DpLoad(const S_DP_DEF* def);
+static void DpStore(const S_DP_DEF* def, uint32_t value);
+static void CommandDp(const S_TUYA_FRAME* f, const S_TUYA_DP* dp);
+static void DoorCommand(uint32_t value);
 static void UnkownOpcode(uint8_t opcode);
 static void RequestPairingMode(uint8_t mode);
+static uint8_t RxPeek(uint16_t i);
+static void RxDrop(uint8_t count);
 
 //////////////////////////////////////////////////////////////////////
 
 void UartSetup()
 {
-    // Set baud registers:
-    const int baud = 9600;
-    const uint32_t master_freq = 2000000;
-    const uint16_t uart_div = master_freq / baud;
+    HalUartSetup(9600);
+
+    BuildProductInfoFrame();
+}
 
-    UART1_BRR1 = (uart_div >> 4) & 0xFF;
-    UART1_BRR2 = uart_div & 0xF | ((uart_div >> 12) << 4);
+void ISR_UART1_RX(void)
+{
+    uint8_t sr = HAL_UART_STATUS();
+    uint8_t rx = HAL_UART_READ();
+    uint8_t next = (RxHead + 1) & RX_RING_MASK;
+    uint16_t ms = (uint16_t)get_milliseconds_now();
+    uint8_t depth;
 
-    UART1_CR2 = 0x0c; // enable REN and TEN
-    UART1_SR &= ~UART1_SR_RXNE; // ack any would-be junk char in the uart.
+    if ((uint16_t)(ms - RxLastMs) >= RX_GAP_MS)
+    {
+        RxGapAt = RxHead;
+        RxGap = true;
+    }
+    RxLastMs = ms;
+    if ((sr & HAL_UART_OVERRUN) && Latency.uart_overruns != 0xFFFF)
+    {
+        Latency.uart_overruns++;
+    }
+    if ((sr & HAL_UART_FRAMING) && Latency.uart_framing != 0xFFFF)
+    {
+        Latency.uart_framing++;
+    }
+
+    if (next == RxTail)
+    {
+        if (Latency.rx_ring_full != 0xFFFF) Latency.rx_ring_full++;
+        return;
+    }
+
+    RxRing[RxHead] = rx;
+    RxHead = next;
+    depth = (next - RxTail) & RX_RING_MASK;
+    if (depth > Latency.rx_depth_max) Latency.rx_depth_max = depth;
+    POST_WORK(WORK_RX);
 }
 
-void TxTask()
+void ISR_UART1_TX(void)
 {
-    static uint8_t TxBufferIndex = 0;
-    
-    if ((UART1_SR & UART1_SR_TXE) && TxBufferIndex < TxBufferLen)
+    if (TxTail != TxHead)
     {
-        UART1_SR &= ~UART1_SR_TXE;
-        UART1_DR = TxBuffer[TxBufferIndex];
-        TxBufferIndex++;
-        if (TxBufferIndex >= TxBufferLen)
-        {
-            TxBufferIndex = 0;
-            TxBufferLen = 0;
-        }
+        HAL_UART_WRITE(TxRing[TxTail]);
+        TxTail = (TxTail + 1) & TX_RING_MASK;
+    }
+    else
+    {
+        HAL_UART_TX_IRQ_OFF(); // Nothing left; re-armed by TxFrameEnd().
     }
 }
 
+void TxFrameBegin(uint8_t opcode)
+{
+    TxPending = TxHead;
+    TxOpcode = opcode;
+    TxOverflow = false;
+    ChksumByte = 0;
+
+    Tx(TUYA_HEADER_1);
+    Tx(TUYA_HEADER_2);
+    Tx(TUYA_VERSION);
+    Tx(opcode);
+    TxLenAt = TxPending;
+    Tx(0); // Length, patched by TxFrameEnd()
+    Tx(0);
+    TxLen = 0;
+}
+
 void Tx(uint8_t byte)
 {
+    uint8_t next = (TxPending + 1) & TX_RING_MASK;
+
     ChksumByte += byte;
-    TxBuffer[TxBufferLen] = byte;
-    TxBufferLen++;
+    TxLen++;
+    if (next == TxTail)
+    {
+        TxOverflow = true;
+        return;
+    }
+    TxRing[TxPending] = byte;
+    TxPending = next;
 }
 
-void TxChksum(void)
+bool TxFrameEnd(void)
 {
-    Tx(ChksumByte);
-    ChksumByte = 0;
+    uint16_t len = TxLen;
+    uint8_t len_h = len >> 8;
+    uint8_t len_l = len & 0xFF;
+    uint8_t sum;
+    uint8_t depth;
+
+    if (!TxOverflow)
+    {
+        TxRing[TxLenAt] = len_h;
+        TxRing[(TxLenAt + 1) & TX_RING_MASK] = len_l;
+    }
+    ChksumByte += len_h + len_l;
+    sum = ChksumByte;
+    Tx(sum);
+    if (TxOverflow)
+    {
+        // Not enough room for the whole frame: drop it rather than send a partial one.
+        TxDroppedFrames++;
+        TraceFrame(TRACE_TX_DROP, TxOpcode, len, sum);
+        return false;
+    }
+    TraceFrame(TRACE_TX_FRAME, TxOpcode, len, sum);
+    TxHead = TxPending;
+    depth = (TxHead - TxTail) & TX_RING_MASK;
+    if (depth > Latency.tx_depth_max) Latency.tx_depth_max = depth;
+    HAL_UART_TX_IRQ_ON();
+    return true;
 }
 
-void TxBytes(uint8_t* buffer, uint8_t len)
+void TxBytes(const uint8_t* buffer, uint8_t len)
 {
     uint8_t i;
     for (i = 0; i < len; i++)
@@ -130,48 +365,244 @@ void TxBytes(uint8_t* buffer, uint8_t len)
     }
 }
 
-void TxCString(char* buffer)
+bool TxFrame(const uint8_t* frame, uint8_t len)
 {
+    uint8_t head = TxHead;
+    uint8_t room = (TxTail - head - 1) & TX_RING_MASK;
     uint8_t i;
-    for (i = 0; buffer[i]; i++)
+
+    if (len > room)
     {
-        Tx(buffer[i]);
+        TxDroppedFrames++;
+        TraceFrame(TRACE_TX_DROP, frame[3], len - TUYA_FRAME_HEADER_LEN - 1, frame[len - 1]);
+        return false;
+    }
+    TraceFrame(TRACE_TX_FRAME, frame[3], len - TUYA_FRAME_HEADER_LEN - 1, frame[len - 1]);
+    for (i = 0; i < len; i++)
+    {
+        TxRing[head] = frame[i];
+        head = (head + 1) & TX_RING_MASK;
     }
+    TxHead = head;
+    HAL_UART_TX_IRQ_ON();
+    return true;
 }
 
-void StatusReport(bool isOpen, uint8_t dpid)
+void BuildProductInfoFrame(void)
 {
-    S_TUYA_DATA_BOOL d;
-    lastKnownDoorState = isOpen;
-    
-    if (!first_heartbeat) return;
+    const char* key = HAL_PRODUCT_KEY;
+    uint8_t* p = ProductInfoFrame + TUYA_FRAME_HEADER_LEN;
+    uint8_t chksum = 0;
+    uint8_t len;
+    uint8_t i;
 
-    d.dpid = dpid;
-    d.len_h = 0;
-    d.len_l = sizeof(uint8_t);
-    d.type = TUYA_TYPE_BOOL;
-    d.value = isOpen ? 0x01 : 0x00; // If sensor shows the door is closed: 0x00.
+    for (i = 0; PRODUCT_INFO_HEAD[i]; i++) *p++ = PRODUCT_INFO_HEAD[i];
+    for (i = 0; key[i] && i < PRODUCT_KEY_MAX; i++) *p++ = key[i];
+    for (i = 0; PRODUCT_INFO_TAIL[i]; i++) *p++ = PRODUCT_INFO_TAIL[i];
+    len = p - (ProductInfoFrame + TUYA_FRAME_HEADER_LEN);
 
-    Tx(TUYA_HEADER_1);
-    Tx(TUYA_HEADER_2);
-    Tx(TUYA_VERSION);
-    Tx(OPCODE_STATUS);
+    ProductInfoFrame[0] = TUYA_HEADER_1;
+    ProductInfoFrame[1] = TUYA_HEADER_2;
+    ProductInfoFrame[2] = TUYA_VERSION;
+    ProductInfoFrame[3] = OPCODE_QUERY_PRODUCT_INFO;
+    ProductInfoFrame[4] = 0;
+    ProductInfoFrame[5] = len; // The real length of the key, not the sample's.
+
+    for (i = 0; i < TUYA_FRAME_HEADER_LEN + len; i++)
+    {
+        chksum += ProductInfoFrame[i];
+    }
+    *p = chksum;
+    ProductInfoFrameLen = TUYA_FRAME_HEADER_LEN + len + 1;
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Datapoint table, generated from TUYA_DATAPOINTS.
+
+#define DP_DEF(name, dpid, type, flags, min, max, var, on_write) \
+    { (dpid), TUYA_TYPE_##type, (flags), sizeof(var), (min), (max), &(var), (on_write) },
+
+static const S_DP_DEF Dps[DP_COUNT] = { TUYA_DATAPOINTS(DP_DEF) };
+
+const S_DP_DEF* DpFind(uint8_t dpid)
+{
+    uint8_t i;
+    for (i = 0; i < DP_COUNT; i++)
+    {
+        if (Dps[i].dpid == dpid) return &Dps[i];
+    }
+    return 0;
+}
+
+uint32_t DpLoad(const S_DP_DEF* def)
+{
+    switch (def->size)
+    {
+        case 1:  return *(uint8_t*)def->var;
+        case 2:  return *(uint16_t*)def->var;
+        default: return *(uint32_t*)def->var;
+    }
+}
+
+void DpStore(const S_DP_DEF* def, uint32_t value)
+{
+    switch (def->size)
+    {
+        case 1:  *(uint8_t*)def->var = value;  break;
+        case 2:  *(uint16_t*)def->var = value; break;
+        default: *(uint32_t*)def->var = value; break;
+    }
+}
+
+//////////////////////////////////////////////////////////////////////
+// Datapoint encoder. Any number of datapoints can go in one status frame,
+// between TxFrameBegin(OPCODE_STATUS) and TxFrameEnd().
+
+void TxDpHeader(uint8_t dpid, uint8_t type, uint8_t len)
+{
+    Tx(dpid);
+    Tx(type);
     Tx(0);
-    Tx(sizeof(d));
-    TxBytes((uint8_t*)&d, sizeof(d));
-    TxChksum();
+    Tx(len);
+}
+
+void TxDp(const S_DP_DEF* def)
+{
+    uint32_t value;
+
+    switch (def->type)
+    {
+        case TUYA_TYPE_RAW:
+        case TUYA_TYPE_STRING:
+            TxDpHeader(def->dpid, def->type, def->size);
+            TxBytes((const uint8_t*)def->var, def->size);
+            return;
+
+        case TUYA_TYPE_UINT32:
+            // Always 4 bytes on the wire, big-endian, whatever the variable's size.
+            value = DpLoad(def);
+            TxDpHeader(def->dpid, def->type, 4);
+            Tx(value >> 24);
+            Tx(value >> 16);
+            Tx(value >> 8);
+            Tx(value);
+            return;
+
+        case TUYA_TYPE_BITMAP:
+            value = DpLoad(def);
+            TxDpHeader(def->dpid, def->type, def->size);
+            if (def->size >= 4) Tx(value >> 24);
+            if (def->size >= 4) Tx(value >> 16);
+            if (def->size >= 2) Tx(value >> 8);
+            Tx(value);
+            return;
+
+        default: // bool and enum are a single byte
+            TxDpHeader(def->dpid, def->type, 1);
+            Tx(DpLoad(def));
+            return;
+    }
+}
+
+bool ReportDps(uint16_t mask)
+{
+    uint8_t i;
+
+    if (!first_heartbeat) return false;
+
+    TxFrameBegin(OPCODE_STATUS);
+    for (i = 0; i < DP_COUNT; i++)
+    {
+        if (mask & DP_BIT(i)) TxDp(&Dps[i]);
+    }
+    if (!TxFrameEnd()) return false;
+    if (mask & DP_BIT(DP_DOOR))
+    {
+        // The door as it is now: anything held for replay is older, and
+        // would only end on this state again, after alarms long past.
+        LinkSent = DoorOpen;
+        LinkQueued = 0;
+    }
+    return true;
+}
+
+void StatusReport(bool isOpen)
+{
+    DoorOpen = isOpen;
+
+    // Behind anything still held back, so the cloud sees the changes in order.
+    // The alarm datapoint goes first, so the app notifies before it redraws.
+    if (LinkQueued || !LinkUp() || !ReportDps(DP_BIT(DP_ALARM) | DP_BIT(DP_DOOR)))
+    {
+        LinkHold(isOpen);
+    }
+}
+
+void LockdownCommand(uint32_t value)
+{
+    uint8_t on = value ? 1 : 0;
+    bool changed = on != Config.lockdown;
+
+    Config.lockdown = on;
+    ReportDps(DP_BIT(DP_LOCKDOWN)); // Confirmed either way
+    if (!changed) return;           // No EEPROM wear or log record for a resend
+    ConfigSave();
+    EventLogPut(EVENTLOG_LOCKDOWN, Config.lockdown);
+}
+
+//////////////////////////////////////////////////////////////////////
+// Store-and-forward
+
+bool LinkUp(void)
+{
+    return first_heartbeat &&
+           (NetStatus == NET_STATUS_CLOUD || NetStatus == NET_STATUS_UNKNOWN) &&
+           get_milliseconds_since(LastHeartbeat) < LINK_HEARTBEAT_TIMEOUT_MS;
+}
+
+void LinkHold(uint8_t open)
+{
+    uint8_t i;
+
+    if (open == (LinkQueued ? LinkQueue[LinkQueued - 1] : LinkSent)) return; // Nothing new
+
+    if (LinkQueued == LINK_QUEUE_MAX)
+    {
+        // Entries alternate, so dropping the oldest two loses one whole cycle
+        // and keeps both the order and the last state.
+        for (i = 2; i < LINK_QUEUE_MAX; i++)
+        {
+            LinkQueue[i - 2] = LinkQueue[i];
+        }
+        LinkQueued -= 2;
+    }
+    LinkQueue[LinkQueued++] = open;
+}
+
+void LinkFlush(void)
+{
+    uint8_t i;
+
+    if (!LinkQueued || !LinkUp()) return;
+
+    TxFrameBegin(OPCODE_STATUS);
+    for (i = 0; i < LinkQueued; i++)
+    {
+        TxDpHeader(DPID_ALARM, TUYA_TYPE_BOOL, 1);
+        Tx(LinkQueue[i]);
+        TxDpHeader(DPID_DOOR, TUYA_TYPE_BOOL, 1);
+        Tx(LinkQueue[i]);
+    }
+    if (!TxFrameEnd()) return; // The next heartbeat tries again
+
+    LinkSent = LinkQueue[LinkQueued - 1];
+    LinkQueued = 0;
 }
 
 void WifiReset(uint8_t mode)
 {
     pairingMode = mode;
-    Tx(TUYA_HEADER_1);
-    Tx(TUYA_HEADER_2);
-    Tx(TUYA_VERSION);
-    Tx(OPCODE_RESET_WIFI);
-    Tx(0);
-    Tx(0);
-    TxChksum();
+    TxFrame(WifiResetFrame, sizeof(WifiResetFrame));
 
     // Pairing mode will be set later.
     wifiResetInProgress = true;
@@ -180,100 +611,129 @@ void WifiReset(uint8_t mode)
 void RequestPairingMode(uint8_t mode)
 {
     pairingMode = mode;
-    Tx(TUYA_HEADER_1);
-    Tx(TUYA_HEADER_2);
-    Tx(TUYA_VERSION);
-    Tx(OPCODE_SET_PAIRING_MODE);
-    Tx(0);
-    Tx(sizeof(mode));
-    Tx(mode);
-    TxChksum();
-    
-}
-
-void StatusReport_Ex()
-{
-    S_TUYA_DATA_UINT32 d;
-    d.dpid = 7; // This is the datapoint id the stock firmware reports.
-    d.type = TUYA_TYPE_UINT32;
-    d.len_h = 0;
-    d.len_l = sizeof(d.value);
-    d.value = 0; // Value (???)
-    Tx(TUYA_HEADER_1);
-    Tx(TUYA_HEADER_2);
-    Tx(TUYA_VERSION);
-    Tx(OPCODE_STATUS);
-    Tx(0);
-    Tx(sizeof(d));
-    TxBytes((uint8_t*)&d, sizeof(d));
-    TxChksum();
-
+    TxFrame(PairingModeFrame[mode ? 1 : 0], sizeof(PairingModeFrame[0]));
 }
 
 void HeartBeat(void)
 {
-    Tx(TUYA_HEADER_1);
-    Tx(TUYA_HEADER_2);
-    Tx(TUYA_VERSION);
-    Tx(OPCODE_HEARTBEAT);
-    Tx(0);
-    Tx(sizeof(first_heartbeat));
-    Tx(first_heartbeat);
-    TxChksum();
+    TxFrame(HeartbeatFrame[first_heartbeat], sizeof(HeartbeatFrame[0]));
     first_heartbeat = 1;
+    LastHeartbeat = get_milliseconds_now();
+    LinkFlush();
 }
 
 void QueryProductInfo(void)
 {
-    #define SAMPLE_PRODUCT_INFO  "{\"p\":\"REDACTEDREDACTED\",\"v\":\"1.0.0\",\"m\":0}"
-    const uint8_t product_info_len = sizeof(SAMPLE_PRODUCT_INFO)-1;
-    char* key = (char*)0x9A58; // This is where the key is located in the stock firmware.
-
-    Tx(TUYA_HEADER_1);
-    Tx(TUYA_HEADER_2);
-    Tx(TUYA_VERSION);
-    Tx(OPCODE_QUERY_PRODUCT_INFO);
-    Tx(0);
-    Tx(product_info_len);
-
-    TxCString("{\"p\":");
-    TxCString("\"");
-    TxCString(key);
-    TxCString("\"");
-    TxCString(",\"v\":\"1.0.0\",\"m\":0}");
-    TxChksum();
+    TxFrame(ProductInfoFrame, ProductInfoFrameLen);
 }
 
 void QueryMCU(void)
 {
-    Tx(TUYA_HEADER_1);
-    Tx(TUYA_HEADER_2);
-    Tx(TUYA_VERSION);
-    Tx(OPCODE_QUERY_MCU);
-    Tx(0); // 0x0000 = module self-processing mode. (i.e. tuya has no reset pin connected to its GPIO)
-    Tx(0);
-    TxChksum();
+    TxFrame(QueryMcuFrame, sizeof(QueryMcuFrame));
 }
 
 void ReportModeAck(void)
 {
-    Tx(TUYA_HEADER_1);
-    Tx(TUYA_HEADER_2);
-    Tx(TUYA_VERSION);
-    Tx(OPCODE_REPORT_NETWORK_STATUS);
-    Tx(0);
-    Tx(0);
-    TxChksum();
+    TxFrame(ReportModeAckFrame, sizeof(ReportModeAckFrame));
 }
 
 void UnkownOpcode(uint8_t opcode)
 {
-	ChksumByte = 0;
+    RxUnknownFrames++;
+    RxUnknownOpcode = opcode;
+}
+
+uint8_t FrameByte(const S_TUYA_FRAME* f, uint16_t i)
+{
+    return RxRing[(uint8_t)(f->start + i) & RX_RING_MASK];
 }
 
-void Process(uint8_t opcode, uint8_t *data)
+//////////////////////////////////////////////////////////////////////
+// Datapoint decoder.
+
+bool DpNext(const S_TUYA_FRAME* f, uint16_t* pos, S_TUYA_DP* dp)
+{
+    // Walks the datapoints of a command frame, one per call. A datapoint
+    // that claims to run past the end of the payload ends the walk.
+    uint16_t at = *pos + TUYA_DP_HEADER_LEN;
+
+    if (at > f->len) return false;
+    dp->dpid = FrameByte(f, *pos);
+    dp->type = FrameByte(f, *pos + 1);
+    dp->len = ((uint16_t)FrameByte(f, *pos + 2) << 8) | FrameByte(f, *pos + 3);
+    dp->at = at;
+    if (dp->len > f->len - at) return false;
+    *pos = at + dp->len;
+    return true;
+}
+
+uint32_t DpValue(const S_TUYA_FRAME* f, const S_TUYA_DP* dp)
+{
+    // bool, value, enum and bitmap are all big-endian integers of 1 to 4 bytes.
+    uint32_t value = 0;
+    uint16_t i;
+
+    for (i = 0; i < dp->len && i < 4; i++)
+    {
+        value = (value << 8) | FrameByte(f, dp->at + i);
+    }
+    return value;
+}
+
+void CommandDp(const S_TUYA_FRAME* f, const S_TUYA_DP* dp)
+{
+    const S_DP_DEF* def = DpFind(dp->dpid);
+    uint32_t value;
+    uint16_t i;
+
+    if (!def) return;
+    if (def->flags & DP_REQUEST)
+    {
+        if (def->on_write) def->on_write(DpValue(f, dp)); // Says what to read
+        ReportDps(DP_BIT(def - Dps)); // Whatever was written, it's only a read
+        return;
+    }
+    if (!(def->flags & DP_WRITE) || def->type != dp->type) return;
+
+    if (def->type == TUYA_TYPE_RAW || def->type == TUYA_TYPE_STRING)
+    {
+        if (dp->len != def->size) return;
+        for (i = 0; i < dp->len; i++)
+        {
+            ((uint8_t*)def->var)[i] = FrameByte(f, dp->at + i);
+        }
+        ReportDps(DP_BIT(def - Dps)); // Confirm the new value
+        return;
+    }
+
+    value = DpValue(f, dp);
+    if (value < def->min || value > def->max) return;
+
+    if (def->on_write)
+    {
+        def->on_write(value);
+    }
+    else
+    {
+        bool changed = value != DpLoad(def);
+
+        DpStore(def, value);
+        ReportDps(DP_BIT(def - Dps));
+        if ((def->flags & DP_SAVE) && changed) ConfigSave(); // Not for a resend
+    }
+}
+
+void DoorCommand(uint32_t value)
 {
-    switch (opcode)
+    // The door datapoint reports where the door is, so a write is a request
+    // to move it. The state machine reports the outcome.
+    EventPost(value ? EVENT_CMD_OPEN : EVENT_CMD_CLOSE, EVENT_SRC_CLOUD,
+              get_milliseconds_now());
+}
+
+void Process(const S_TUYA_FRAME* f)
+{
+    switch (f->opcode)
     {
         case OPCODE_HEARTBEAT:
         {
@@ -283,9 +743,12 @@ void Process(uint8_t opcode, uint8_t *data)
 
         case OPCODE_COMMAND:
         {
-            S_TUYA_DATA_BOOL* d = (S_TUYA_DATA_BOOL*)data;
-            if (d->value == 1) RxCommand_open = true;
-            if (d->value == 0) RxCommand_close = true;
+            S_TUYA_DP dp;
+            uint16_t pos = 0;
+            while (DpNext(f, &pos, &dp))
+            {
+                CommandDp(f, &dp);
+            }
         }
         break;
 
@@ -303,14 +766,23 @@ void Process(uint8_t opcode, uint8_t *data)
 
         case OPCODE_QUERY_STATUS:
         {
-            StatusReport(lastKnownDoorState, 1);
-            StatusReport_Ex(); // Must send this dummy data, or else this doesn't work.
+            uint8_t i;
+            uint16_t mask = 0;
+            for (i = 0; i < DP_COUNT; i++)
+            {
+                if (Dps[i].flags & DP_QUERY) mask |= DP_BIT(i);
+            }
+            // The answer alone: a replay (47 bytes) ahead of it would leave
+            // no room in the TX ring, and the door in it supersedes what's held.
+            ReportDps(mask);
         }
         break;
 
         case OPCODE_REPORT_NETWORK_STATUS:
         {
+            if (f->len >= 1) NetStatus = FrameByte(f, 0);
             ReportModeAck();
+            LinkFlush();
         }
         break;
         
@@ -324,130 +796,122 @@ void Process(uint8_t opcode, uint8_t *data)
             wifiResetInProgress = false; // This is an ACK.
         break;
 
+        case OPCODE_UPGRADE_START:
+        {
+            // The bootloader answers it and takes the packages (ota.h).
+            // OtaRequest() only comes back if the image can't fit.
+            uint32_t size = 0;
+            uint8_t i;
+            if (f->len != 4) break;
+            for (i = 0; i < 4; i++)
+            {
+                size = (size << 8) | FrameByte(f, i);
+            }
+            OtaRequest(size);
+        }
+        break;
+
         default:
         {
-            UnkownOpcode(opcode);
+            UnkownOpcode(f->opcode);
         }
         break;
     }
 }
 
+// Parser state. RxScan counts the bytes from RxTail that have already been
+// checked and folded into RxSum, so each byte is only summed once however
+// many passes it takes for the rest of the frame to arrive. RxStale counts
+// the bytes from RxTail that came in before the last pause.
+static uint16_t RxScan = 0;
+static uint8_t RxSum = 0;
+static uint8_t RxStale = 0;
+
+uint8_t RxPeek(uint16_t i)
+{
+    return RxRing[(uint8_t)(RxTail + i) & RX_RING_MASK];
+}
+
+void RxDrop(uint8_t count)
+{
+    RxTail = (RxTail + count) & RX_RING_MASK;
+    RxScan = 0;
+    RxSum = 0;
+    RxStale = RxStale > count ? RxStale - count : 0;
+}
+
 void RxTask(void)
 {
-    enum {
-        HDR_BYTE_1,
-        HDR_BYTE_2,
-        MODULE_VER,
-        OPCODE_BYTE,
-        LEN_BYTE_H,
-        LEN_BYTE_L,
-        DATA_BYTES,
-        CSUM_BYTE,
-        INITIAL_STATE = HDR_BYTE_1
-    };
-
-    static int state = INITIAL_STATE;
-    static uint8_t opcode;
-    static uint8_t msgLen;
-    static uint8_t data[6];
-    static uint8_t dataIndex;
-
-    if (UART1_SR & UART1_SR_RXNE)
+    S_TUYA_FRAME f;
+    uint8_t avail;
+    uint16_t total;
+
+    INTERRUPT_DIS();
+    if (RxGap)
     {
-        uint8_t rx = UART1_DR;
-        UART1_SR &= ~UART1_SR_RXNE;
-        switch (state)
+        RxStale = (RxGapAt - RxTail) & RX_RING_MASK;
+        RxGap = false;
+    }
+    INTERRUPT_EN();
+
+    // Each pass either waits for more bytes, drops a byte that can't start a
+    // frame, or consumes one whole frame.
+    while ((avail = (RxHead - RxTail) & RX_RING_MASK) != 0)
+    {
+        if (RxScan == 0)
+        {
+            if (RxPeek(0) != TUYA_HEADER_1) { RxDrop(1); continue; }
+            RxSum = TUYA_HEADER_1;
+            RxScan = 1;
+        }
+        if (RxScan < TUYA_FRAME_HEADER_LEN)
+        {
+            if (avail < TUYA_FRAME_HEADER_LEN) break;
+            if (RxPeek(1) != TUYA_HEADER_2 || RxPeek(2) != TUYA_RX_VERSION)
+            {
+                RxDrop(1); // Resync on the next 0x55
+                continue;
+            }
+            total = ((uint16_t)RxPeek(4) << 8) | RxPeek(5);
+            if (total + TUYA_FRAME_HEADER_LEN + 1 > RX_FRAME_MAX)
+            {
+                RxDrop(1);
+                continue;
+            }
+            RxSum += RxPeek(1) + RxPeek(2) + RxPeek(3) + RxPeek(4) + RxPeek(5);
+            RxScan = TUYA_FRAME_HEADER_LEN;
+        }
+
+        total = ((uint16_t)RxPeek(4) << 8) | RxPeek(5);
+        total += TUYA_FRAME_HEADER_LEN; // Everything the checksum covers
+        if (RxStale && total >= RxStale)
+        {
+            RxDrop(1); // Begun before the pause, and not finished by it
+            continue;
+        }
+        while (RxScan < total && RxScan < avail)
         {
-            case HDR_BYTE_1: 
-                if (rx == TUYA_HEADER_1)
-                {
-                    state++;
-                }
-                else
-                {
-                    state = INITIAL_STATE;
-                }
-                break;
-
-            case HDR_BYTE_2: 
-                if (rx == TUYA_HEADER_2)
-                {
-                    state++;
-                }
-                else
-                {
-                    state = INITIAL_STATE;
-                }
-                break;
-
-            case MODULE_VER: 
-                if (rx == 0x00)
-                {
-                    state++;
-                }
-                else
-                {
-                    state = INITIAL_STATE;
-                }
-                break;
-
-            case OPCODE_BYTE:
-                {
-                    opcode = rx;
-                    state++;
-                }
-                break;
-
-            case LEN_BYTE_H:
-                if (rx == 0x00)
-                {
-                    msgLen = 0;
-                    dataIndex = 0;
-                    state++;
-                } 
-                else
-                {
-                    state = INITIAL_STATE;
-                }	
-                break;
-
-            case LEN_BYTE_L:
-                {
-                    msgLen = rx;
-                    state++;
-                    if (msgLen > sizeof(data))
-                    {
-                        state = INITIAL_STATE;
-                    }
-                    else if (msgLen > 0)
-                    {
-                        state = DATA_BYTES;
-                    }
-                    else
-                    {
-                        state = CSUM_BYTE;
-                    }
-  
-                }
-                break;
-
-            case DATA_BYTES:
-                {
-                    data[dataIndex] = rx;
-                    dataIndex++;
-                    if (msgLen == dataIndex)
-                    {
-                        state++;
-                    }
-                }
-                break;
-
-            case CSUM_BYTE:
-                {
-                    Process(opcode, data);
-                    state = INITIAL_STATE;
-                }
-                break;
+            RxSum += RxPeek(RxScan);
+            RxScan++;
         }
+        if (avail <= total) break; // The checksum byte isn't in yet
+
+        if (RxPeek(total) != RxSum)
+        {
+            // Whatever this was, a real frame may start inside it.
+            RxBadFrames++;
+            TraceFrame(TRACE_RX_BAD, RxPeek(3), total - TUYA_FRAME_HEADER_LEN, RxPeek(total));
+            RxDrop(1);
+            continue;
+        }
+
+        f.opcode = RxPeek(3);
+        f.len = total - TUYA_FRAME_HEADER_LEN;
+        f.start = (RxTail + TUYA_FRAME_HEADER_LEN) & RX_RING_MASK;
+        TraceFrame(TRACE_RX_FRAME, f.opcode, f.len, RxSum); // Ahead of any answer
+        BENCH_BEGIN(FRAME_PROBE(f.opcode));
+        Process(&f);
+        BENCH_END(FRAME_PROBE(f.opcode));
+        RxDrop(total + 1);
     }
 }
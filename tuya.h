@@ -1,12 +1,18 @@
 #pragma once
+#include <stdint.h>
 #include <stdbool.h>
 
 void RxTask(void);
-void TxTask(void);
 void UartSetup(void);
-void StatusReport(bool isOpen, uint8_t dpid);
+void StatusReport(bool isOpen);
+void LockdownCommand(uint32_t value); // Sets, saves, reports and logs it: the button's and the cloud's way in
 void WifiReset(uint8_t mode);
 
-extern bool RxCommand_open;
-extern bool RxCommand_close;
+void ISR_UART1_RX(void);
+void ISR_UART1_TX(void);
+
 extern bool wifiResetInProgress;
+extern uint16_t TxDroppedFrames;
+extern uint16_t RxBadFrames;
+extern uint16_t RxUnknownFrames;
+extern uint8_t RxUnknownOpcode;